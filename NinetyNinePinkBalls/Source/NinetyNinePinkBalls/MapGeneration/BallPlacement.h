@@ -0,0 +1,309 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+#include "CellSampler.h"
+#include "MapTypes.h"
+#include "WallGrid.h"
+
+// Key of the rng stream the balls are drawn from, keeps them independent of
+// the other draws of the map.
+inline constexpr uint64_t ball_stream_key = 0xBA11;
+
+struct ball_placement_config_t {
+  int count;
+  // Minimum distance between two balls and between a ball and a wall, in
+  // world units.
+  double min_distance;
+  double wall_clearance;
+  // Candidates tried around a ball before it stops spreading.
+  int attempts = 16;
+  // When the rooms are full before `count` balls are placed, min_distance is
+  // scaled by relax_factor and the sampling continues, at most max_passes
+  // times. The last pass may still place fewer balls than asked.
+  double relax_factor = 0.75;
+  int max_passes = 6;
+};
+
+// Poisson-disk sampling (Bridson) restricted to the walkable cells of a map.
+// `rooms` gives the room of every cell, row-major, -1 for cells that can't be
+// walked on. Every room gets a share of the balls proportional to its area
+// times its density and the sampling grows from one seed per room, candidates
+// leaving the room of their parent are rejected. Neighbours are looked up in
+// a background grid of min_distance / sqrt(2) cells, each holding at most one
+// ball, so a candidate only checks the 21 slots around it. The walls around
+// every cell are gathered once into a mask, a candidate reads a single byte
+// instead of testing the wall planes.
+class ball_placer_t {
+  std::vector<int> rooms;
+  // Bits 0-3 are the walls of the cell in `direction` order, bits 4-7 the
+  // wall ends on its corners, (0, 0), (0, 1), (1, 0) and (1, 1) in (row,
+  // column) from its top left one.
+  std::vector<uint8_t> wall_masks;
+  double cell_size;
+  double inv_cell_size;
+  int width;
+  int height;
+  cell_sampler_t room_cells;
+
+  // Balls spread from one of the newest active balls rather than any of
+  // them, so the candidates stay close in memory. The sampling still ends
+  // with every room full, only the order it fills them in changes.
+  static constexpr int recent_window = 32;
+
+  // Background grid of the current pass, with two empty slots of padding on
+  // every side so the neighbourhood of a slot never leaves the grid.
+  double slot_scale = 0;
+  double slot_size = 0;
+  int slots_x = 0;
+  int slots_y = 0;
+  // Position of the ball in every slot relative to the slot's corner, floats
+  // are exact enough there and halve the grid. Empty slots are far away so
+  // the distance test needs no branch.
+  struct slot_t { float x, y; };
+  std::vector<slot_t> slots;
+  // The 21 slots around a slot and the position of their corner relative to
+  // its one, nearest first: most candidates are rejected and the ball that
+  // rejects them is usually in the slots next to theirs.
+  struct neighbour_t { ptrdiff_t offset; double x, y; };
+  std::array<neighbour_t, 21> neighbours{};
+  std::vector<vector_t> balls;
+
+public:
+  ball_placer_t(const wall_grid_t& w, std::vector<int> r, double size)
+      : rooms(std::move(r)), wall_masks(rooms.size(), 0), cell_size(size), inv_cell_size(1 / size),
+        width(w.get_width()), height(w.get_height()), room_cells(w.get_width()) {
+    // Grid vertices where a wall ends, then the mask of every cell from its
+    // four edges and four corners.
+    const int columns = width + 1;
+    std::vector<uint8_t> wall_ends(static_cast<size_t>(height + 1) * columns, 0);
+    for (int i = 0; i <= height; ++i) {
+      for (int j = 0; j <= width; ++j) {
+        if (j < width && w.horizontal().test(i, j)) {
+          wall_ends[static_cast<size_t>(i) * columns + j] = 1;
+          wall_ends[static_cast<size_t>(i) * columns + j + 1] = 1;
+        }
+        if (i < height && w.vertical().test(i, j)) {
+          wall_ends[static_cast<size_t>(i) * columns + j] = 1;
+          wall_ends[static_cast<size_t>(i + 1) * columns + j] = 1;
+        }
+      }
+    }
+    for (int i = 0; i < height; ++i) {
+      for (int j = 0; j < width; ++j) {
+        const cell_t walls = w.cell(i, j);
+        const uint8_t* top = &wall_ends[static_cast<size_t>(i) * columns + j];
+        wall_masks[static_cast<size_t>(i) * width + j] = static_cast<uint8_t>(
+          walls.n | walls.s << 1 | walls.e << 2 | walls.w << 3 |
+          top[0] << 4 | top[1] << 5 | top[columns] << 6 | top[columns + 1] << 7);
+      }
+    }
+
+    int room_count = 0;
+    for (int room : rooms) room_count = std::max(room_count, room + 1);
+
+    // Counting sort of the cells by room so every room is a contiguous range.
+    std::vector<std::vector<int>> by_room(room_count);
+    for (int cell = 0; cell < width * height; ++cell) {
+      if (rooms[cell] >= 0) by_room[rooms[cell]].push_back(cell);
+    }
+    for (const auto& cells : by_room) {
+      room_cells.begin_room();
+      for (int cell : cells) room_cells.add(cell / width, cell % width);
+    }
+  }
+
+  // `density` holds one weight per room, missing rooms weigh 1.
+  std::vector<vector_t> place(const ball_placement_config_t& config, rng_t& rng,
+                              const std::vector<double>& density = {}) {
+    balls.clear();
+    std::vector<int> ball_room;
+    std::vector<int> quota = quotas(config.count, density);
+    int remaining = config.count;
+    balls.reserve(config.count);
+
+    std::vector<std::pair<double, double>> circle(config.attempts);
+    for (int t = 0; t < config.attempts; ++t) {
+      double angle = 2 * std::numbers::pi * t / config.attempts;
+      circle[t] = {std::cos(angle), std::sin(angle)};
+    }
+
+    double radius = config.min_distance;
+    for (int pass = 0; pass < config.max_passes && remaining > 0 && radius > 0; ++pass) {
+      reset_slots(radius);
+      std::vector<int> active;
+      for (int k = 0; k < static_cast<int>(balls.size()); ++k) {
+        insert(balls[k]);
+        active.push_back(k);
+      }
+
+      auto accept = [&](const vector_t& p, int room) {
+        int k = static_cast<int>(balls.size());
+        balls.push_back(p);
+        ball_room.push_back(room);
+        insert(p);
+        active.push_back(k);
+        --quota[room];
+        --remaining;
+      };
+
+      // One seed per room that still needs balls and has none to grow from.
+      std::vector<uint8_t> seeded(quota.size(), 0);
+      for (int k : active) seeded[ball_room[k]] = 1;
+      for (int room = 0; room < static_cast<int>(quota.size()); ++room) {
+        if (quota[room] <= 0 || seeded[room]) continue;
+        for (int t = 0; t < config.attempts; ++t) {
+          point_t cell = *room_cells.sample_in_room(rng, room);
+          vector_t p{(cell.y + rng.unit()) * cell_size, (cell.x + rng.unit()) * cell_size, 0.0};
+          if (is_valid(p, room, radius, config.wall_clearance)) {
+            accept(p, room);
+            break;
+          }
+        }
+      }
+
+      while (!active.empty() && remaining > 0) {
+        const int newest = static_cast<int>(active.size()) - 1;
+        int slot = rng.uniform(std::max(newest - recent_window + 1, 0), newest);
+        int k = active[slot];
+        int room = ball_room[k];
+        bool spread = false;
+
+        // Candidates evenly spread on the circle of radius `radius` from a
+        // random angle (Roberts' variant of Bridson), they pack tighter and
+        // are rejected less often than candidates drawn in the annulus.
+        // The circle is precomputed and rotated, no trigonometry per candidate.
+        const double offset = 2 * std::numbers::pi * rng.unit();
+        const double rc = std::cos(offset) * radius * (1 + 1e-6);
+        const double rs = std::sin(offset) * radius * (1 + 1e-6);
+        for (int t = 0; quota[room] > 0 && t < config.attempts; ++t) {
+          auto [c, sn] = circle[t];
+          vector_t p{balls[k].X + c * rc - sn * rs, balls[k].Y + sn * rc + c * rs, 0.0};
+          if (is_valid(p, room, radius, config.wall_clearance)) {
+            accept(p, room);
+            spread = true;
+            break;
+          }
+        }
+
+        if (!spread) {
+          active[slot] = active.back();
+          active.pop_back();
+        }
+      }
+
+      radius *= config.relax_factor;
+    }
+
+    return balls;
+  }
+
+private:
+  // Share of `count` for every room, largest remainder so they add up.
+  std::vector<int> quotas(int count, const std::vector<double>& density) const {
+    const int n = room_cells.room_count();
+    std::vector<double> share(n, 0.0);
+    double total = 0;
+    for (int room = 0; room < n; ++room) {
+      double weight = room < static_cast<int>(density.size()) ? std::max(density[room], 0.0) : 1.0;
+      share[room] = weight * room_cells.room_size(room);
+      total += share[room];
+    }
+
+    std::vector<int> quota(n, 0);
+    if (total <= 0) return quota;
+
+    int given = 0;
+    std::vector<std::pair<double, int>> remainders;
+    for (int room = 0; room < n; ++room) {
+      double exact = count * share[room] / total;
+      quota[room] = static_cast<int>(exact);
+      given += quota[room];
+      if (share[room] > 0) remainders.push_back({quota[room] - exact, room});
+    }
+    std::sort(remainders.begin(), remainders.end());
+    for (int k = 0; given < count && k < static_cast<int>(remainders.size()); ++k, ++given) {
+      ++quota[remainders[k].second];
+    }
+    return quota;
+  }
+
+  void reset_slots(double radius) {
+    slot_scale = std::sqrt(2.0) / radius;
+    slot_size = radius / std::sqrt(2.0);
+    slots_x = static_cast<int>(std::ceil(width * cell_size * slot_scale));
+    slots_y = static_cast<int>(std::ceil(height * cell_size * slot_scale));
+    slots.assign(static_cast<size_t>(slots_x + 4) * (slots_y + 4), {-1e30f, -1e30f});
+
+    // The corners of the 5x5 block are always farther than `radius`.
+    int count = 0;
+    for (int ring = 0; ring <= 8; ++ring) {
+      for (int y = -2; y <= 2; ++y) {
+        for (int x = -2; x <= 2; ++x) {
+          if (x * x + y * y != ring || ring == 8) continue;
+          neighbours[count++] = {static_cast<ptrdiff_t>(y) * (slots_x + 4) + x, x * slot_size, y * slot_size};
+        }
+      }
+    }
+  }
+
+  void insert(const vector_t& p) {
+    const int x = slot_of(p.X, slots_x);
+    const int y = slot_of(p.Y, slots_y);
+    slots[slot_index(x, y)] = {static_cast<float>(p.X - x * slot_size), static_cast<float>(p.Y - y * slot_size)};
+  }
+
+  [[nodiscard]] int slot_of(double coordinate, int slot_count) const {
+    return std::clamp(static_cast<int>(coordinate * slot_scale), 0, slot_count - 1);
+  }
+
+  [[nodiscard]] size_t slot_index(int x, int y) const {
+    return static_cast<size_t>(y + 2) * (slots_x + 4) + x + 2;
+  }
+
+  [[nodiscard]] bool is_valid(const vector_t& p, int room, double radius, double clearance) const {
+    if (p.X < 0 || p.Y < 0) return false;
+    int i = static_cast<int>(p.Y * inv_cell_size);
+    int j = static_cast<int>(p.X * inv_cell_size);
+    if (i >= height || j >= width) return false;
+    const size_t cell = static_cast<size_t>(i) * width + j;
+    if (rooms[cell] != room || !clear_of_walls(p.X - j * cell_size, p.Y - i * cell_size, wall_masks[cell], clearance)) {
+      return false;
+    }
+
+    const int x = slot_of(p.X, slots_x);
+    const int y = slot_of(p.Y, slots_y);
+    const double u = p.X - x * slot_size;
+    const double v = p.Y - y * slot_size;
+    const slot_t* center = &slots[slot_index(x, y)];
+    for (const neighbour_t& n : neighbours) {
+      const slot_t& other = center[n.offset];
+      double dx = other.x + n.x - u;
+      double dy = other.y + n.y - v;
+      if (dx * dx + dy * dy < radius * radius) return false;
+    }
+    return true;
+  }
+
+  // Walls of the cell and the wall ends on its corners, a wall of a
+  // neighbour only reaches into the cell through a corner. (u, v) is the
+  // point relative to the top left corner of the cell.
+  [[nodiscard]] bool clear_of_walls(double u, double v, uint8_t mask, double clearance) const {
+    const double far = cell_size - clearance;
+    const int near_v = (v < clearance) | (v > far) << 1;
+    const int near_u = (u > far) << 2 | (u < clearance) << 3;
+    if ((near_v | near_u) & mask) return false;
+    if (!near_v || !near_u || !(mask >> 4)) return true;
+
+    for (int corner = 0; corner < 4; ++corner) {
+      double du = u - corner % 2 * cell_size;
+      double dv = v - corner / 2 * cell_size;
+      if (du * du + dv * dv < clearance * clearance && (mask >> (4 + corner) & 1)) return false;
+    }
+    return true;
+  }
+};
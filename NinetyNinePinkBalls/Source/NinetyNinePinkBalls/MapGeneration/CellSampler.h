@@ -0,0 +1,107 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include "MapTypes.h"
+
+// Index of the walkable cells of a map grouped by room, for spawn points. The
+// cells of a room are added together so each room is a contiguous range of
+// `cells`, and every draw is O(1):
+//  - sample: uniform over all the cells.
+//  - sample_in_room: uniform over the cells of one room.
+//  - sample_weighted: room picked from the weights given to set_room_weights
+//    (Vose alias table), then a uniform cell in it.
+class cell_sampler_t {
+  int width = 0;
+  std::vector<int> cells;
+  std::vector<int> room_begin{0};
+  std::vector<double> alias_prob;
+  std::vector<int> alias;
+
+public:
+  cell_sampler_t() = default;
+  explicit cell_sampler_t(int w) : width(w) {}
+
+  // Starts a new room and returns its id, rooms are numbered from 0.
+  int begin_room() {
+    room_begin.push_back(room_begin.back());
+    return room_count() - 1;
+  }
+
+  // Adds (i, j) to the last room.
+  void add(int i, int j) {
+    cells.push_back(i * width + j);
+    ++room_begin.back();
+  }
+
+  [[nodiscard]] bool empty() const { return cells.empty(); }
+  [[nodiscard]] size_t size() const { return cells.size(); }
+  [[nodiscard]] int room_count() const { return static_cast<int>(room_begin.size()) - 1; }
+
+  [[nodiscard]] int room_size(int room) const {
+    return room_begin[room + 1] - room_begin[room];
+  }
+
+  std::optional<point_t> sample(rng_t& rng) const {
+    if (cells.empty()) return std::nullopt;
+    return at(rng.uniform(0, static_cast<int>(cells.size()) - 1));
+  }
+
+  std::optional<point_t> sample_in_room(rng_t& rng, int room) const {
+    if (room < 0 || room >= room_count() || room_size(room) == 0) return std::nullopt;
+    return at(rng.uniform(room_begin[room], room_begin[room + 1] - 1));
+  }
+
+  // One weight per room, missing rooms weigh 0. Empty rooms are never picked.
+  void set_room_weights(const std::vector<double>& weights) {
+    const int n = room_count();
+    alias_prob.assign(n, 0.0);
+    alias.assign(n, 0);
+
+    std::vector<double> scaled(n, 0.0);
+    double total = 0;
+    for (int r = 0; r < n; ++r) {
+      if (r < static_cast<int>(weights.size()) && room_size(r) > 0) scaled[r] = std::max(weights[r], 0.0);
+      total += scaled[r];
+    }
+    if (total <= 0) {
+      alias_prob.clear();
+      return;
+    }
+
+    std::vector<int> small, large;
+    for (int r = 0; r < n; ++r) {
+      scaled[r] *= n / total;
+      (scaled[r] < 1.0 ? small : large).push_back(r);
+    }
+    while (!small.empty() && !large.empty()) {
+      int s = small.back(); small.pop_back();
+      int l = large.back();
+      alias_prob[s] = scaled[s];
+      alias[s] = l;
+      scaled[l] -= 1.0 - scaled[s];
+      if (scaled[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // Leftovers are 1 up to rounding errors.
+    for (int r : large) alias_prob[r] = 1.0;
+    for (int r : small) alias_prob[r] = 1.0;
+  }
+
+  // Uniform over the cells until set_room_weights is called with a positive
+  // weight.
+  std::optional<point_t> sample_weighted(rng_t& rng) const {
+    if (alias_prob.empty()) return sample(rng);
+    int room = rng.uniform(0, static_cast<int>(alias_prob.size()) - 1);
+    if (rng.unit() >= alias_prob[room]) room = alias[room];
+    if (auto cell = sample_in_room(rng, room)) return cell;
+    return sample(rng);
+  }
+
+private:
+  [[nodiscard]] point_t at(int k) const { return {cells[k] / width, cells[k] % width}; }
+};
@@ -0,0 +1,112 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "MapTypes.h"
+
+// Colliders of a map as a structure of arrays. Collider k is a run of
+// length(k) cell edges starting on the grid vertex (x, y), x the column and y
+// the line, going along the columns when horizontal and along the lines when
+// vertical. Orientation and doors take one bit per collider. Every array is
+// contiguous, so the buffer can be handed as is to instancing or
+// serialization, and filling it only grows five arrays.
+class collider_buffer_t {
+  double cell_size = 1;
+  std::vector<int32_t> xs;
+  std::vector<int32_t> ys;
+  std::vector<int32_t> lengths;
+  std::vector<uint64_t> vertical_bits;
+  std::vector<uint64_t> door_bits;
+
+public:
+  collider_buffer_t() = default;
+  explicit collider_buffer_t(double size) : cell_size(size) {}
+
+  void reserve(size_t count) {
+    xs.reserve(count);
+    ys.reserve(count);
+    lengths.reserve(count);
+    vertical_bits.reserve((count + 63) / 64);
+    door_bits.reserve((count + 63) / 64);
+  }
+
+  void clear() {
+    xs.clear();
+    ys.clear();
+    lengths.clear();
+    vertical_bits.clear();
+    door_bits.clear();
+  }
+
+  void push_back(int x, int y, int length, wall_orientation orientation, bool door = false) {
+    const size_t k = xs.size();
+    if ((k & 63) == 0) {
+      vertical_bits.push_back(0);
+      door_bits.push_back(0);
+    }
+    xs.push_back(x);
+    ys.push_back(y);
+    lengths.push_back(length);
+    vertical_bits.back() |= static_cast<uint64_t>(orientation == wall_orientation::V) << (k & 63);
+    door_bits.back() |= static_cast<uint64_t>(door) << (k & 63);
+  }
+
+  // Appends the colliders of `other` after these ones, in order.
+  void append(const collider_buffer_t& other) {
+    const size_t offset = xs.size();
+    xs.insert(xs.end(), other.xs.begin(), other.xs.end());
+    ys.insert(ys.end(), other.ys.begin(), other.ys.end());
+    lengths.insert(lengths.end(), other.lengths.begin(), other.lengths.end());
+    append_bits(vertical_bits, other.vertical_bits, offset);
+    append_bits(door_bits, other.door_bits, offset);
+  }
+
+  [[nodiscard]] size_t size() const { return xs.size(); }
+  [[nodiscard]] bool empty() const { return xs.empty(); }
+  [[nodiscard]] double get_cell_size() const { return cell_size; }
+
+  // Raw arrays, the bit planes hold collider k in bit k % 64 of word k / 64.
+  [[nodiscard]] std::span<const int32_t> grid_x() const { return xs; }
+  [[nodiscard]] std::span<const int32_t> grid_y() const { return ys; }
+  [[nodiscard]] std::span<const int32_t> grid_length() const { return lengths; }
+  [[nodiscard]] std::span<const uint64_t> vertical_plane() const { return vertical_bits; }
+  [[nodiscard]] std::span<const uint64_t> door_plane() const { return door_bits; }
+
+  [[nodiscard]] bool is_vertical(size_t k) const { return (vertical_bits[k >> 6] >> (k & 63)) & 1; }
+  [[nodiscard]] bool is_door(size_t k) const { return (door_bits[k >> 6] >> (k & 63)) & 1; }
+
+  [[nodiscard]] wall_orientation orientation(size_t k) const {
+    return is_vertical(k) ? wall_orientation::V : wall_orientation::H;
+  }
+
+  // World length and centre of collider k.
+  [[nodiscard]] double length(size_t k) const { return lengths[k] * cell_size; }
+
+  [[nodiscard]] vector_t centroid(size_t k) const {
+    if (is_vertical(k)) return {xs[k] * cell_size, (ys[k] + lengths[k] / 2.0) * cell_size, 0.0};
+    return {(xs[k] + lengths[k] / 2.0) * cell_size, ys[k] * cell_size, 0.0};
+  }
+
+  [[nodiscard]] size_t memory_size() const {
+    return (xs.capacity() + ys.capacity() + lengths.capacity()) * sizeof(int32_t) +
+           (vertical_bits.capacity() + door_bits.capacity()) * sizeof(uint64_t);
+  }
+
+private:
+  // Bits of `from` placed after the first `offset` bits of `to`. The bits
+  // past the last collider are always 0, so they can be OR-ed in place.
+  void append_bits(std::vector<uint64_t>& to, const std::vector<uint64_t>& from, size_t offset) {
+    const int shift = static_cast<int>(offset & 63);
+    if (shift == 0) {
+      to.insert(to.end(), from.begin(), from.end());
+      return;
+    }
+    for (uint64_t word : from) {
+      to.back() |= word << shift;
+      to.push_back(word >> (64 - shift));
+    }
+    to.resize((xs.size() + 63) / 64);
+  }
+};
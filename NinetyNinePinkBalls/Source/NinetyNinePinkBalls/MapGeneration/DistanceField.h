@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include "MapTypes.h"
+#include "WallGrid.h"
+
+// Path distance, in cells, from a source cell to every cell of a wall grid.
+// The breadth first search visits the cells by increasing distance, so the
+// visit order doubles as a bucket list: the cells at distance d are
+// order[first_at[d]] .. order[first_at[d + 1] - 1] and a random cell in a
+// distance range is a single draw.
+class distance_field_t {
+  int width = 0;
+  int height = 0;
+  std::vector<int> distance;
+  std::vector<int> order;
+  std::vector<int> first_at;
+
+public:
+  distance_field_t(const wall_grid_t& grid, point_t source)
+      : width(grid.get_width()), height(grid.get_height()),
+        distance(static_cast<size_t>(width) * height, -1) {
+    order.reserve(distance.size());
+
+    int start = source.x * width + source.y;
+    distance[start] = 0;
+    order.push_back(start);
+
+    for (size_t head = 0; head < order.size(); ++head) {
+      int cell = order[head];
+      int i = cell / width;
+      int j = cell % width;
+      if (head == 0 || distance[cell] != distance[order[head - 1]]) {
+        first_at.push_back(static_cast<int>(head));
+      }
+
+      for (int dir = 0; dir < 4; ++dir) {
+        int ni = i + direction[dir].x;
+        int nj = j + direction[dir].y;
+        if (!grid.in_bounds(ni, nj) || grid.is_wall(i, j, dir)) continue;
+
+        int next = ni * width + nj;
+        if (distance[next] >= 0) continue;
+        distance[next] = distance[cell] + 1;
+        order.push_back(next);
+      }
+    }
+    first_at.push_back(static_cast<int>(order.size()));
+  }
+
+  // -1 when the cell can't be reached from the source.
+  [[nodiscard]] int at(int i, int j) const { return distance[static_cast<size_t>(i) * width + j]; }
+
+  [[nodiscard]] int max_distance() const { return static_cast<int>(first_at.size()) - 2; }
+  [[nodiscard]] size_t reachable_count() const { return order.size(); }
+
+  // Random reachable cell whose distance is in [lo, hi], none when the range
+  // is empty.
+  std::optional<point_t> sample(rng_t& rng, int lo, int hi) const {
+    lo = std::max(lo, 0);
+    hi = std::min(hi, max_distance());
+    if (lo > hi) return std::nullopt;
+
+    int k = rng.uniform(first_at[lo], first_at[hi + 1] - 1);
+    return point_t{order[k] / width, order[k] % width};
+  }
+
+  // Same but falls back to the farthest cells when none is at least lo away.
+  point_t sample_or_farthest(rng_t& rng, int lo, int hi) const {
+    lo = std::min(lo, max_distance());
+    return *sample(rng, lo, std::max(lo, hi));
+  }
+};
+
+struct spawn_points_t {
+  vector_t player;
+  vector_t ghost;
+};
+
+// Player at a random point of `player_cell` and ghost in a cell whose path
+// distance to it is in [min_distance, max_distance], cells are (row, column).
+inline spawn_points_t place_spawn_points(const wall_grid_t& grid, rng_t& rng, point_t player_cell,
+                                         int segment_length, int min_distance, int max_distance) {
+  distance_field_t field(grid, player_cell);
+  point_t ghost_cell = field.sample_or_farthest(rng, min_distance, max_distance);
+
+  return {
+    random_point_in_cell(rng, player_cell.y, player_cell.x, segment_length),
+    random_point_in_cell(rng, ghost_cell.y, ghost_cell.x, segment_length)
+  };
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Rectangle of floor cells of one material, x is the column and y the row of
+// its top left cell.
+struct floor_rect_t {
+  int x, y;
+  int width, height;
+  int material;
+};
+
+// Covers the cells of `materials` (row-major, `width` columns) with few
+// rectangles of a single material, cells of material -1 have no floor.
+// Greedy meshing: the first uncovered cell in row-major order starts a
+// rectangle that grows right as far as the material goes, then down while the
+// whole run below matches. Not always the fewest rectangles but O(cells) and
+// within a small factor of it on maze and pavage floors.
+inline std::vector<floor_rect_t> merge_floor_cells(const std::vector<int>& materials, int width, int height) {
+  std::vector<floor_rect_t> rects;
+  std::vector<uint8_t> covered(materials.size(), 0);
+  auto at = [&](int i, int j) { return static_cast<size_t>(i) * width + j; };
+
+  for (int i = 0; i < height; ++i) {
+    for (int j = 0; j < width; ++j) {
+      const int material = materials[at(i, j)];
+      if (material < 0 || covered[at(i, j)]) continue;
+
+      int w = 1;
+      while (j + w < width && materials[at(i, j + w)] == material && !covered[at(i, j + w)]) ++w;
+
+      int h = 1;
+      for (; i + h < height; ++h) {
+        bool row_matches = true;
+        for (int k = j; k < j + w && row_matches; ++k) {
+          row_matches = materials[at(i + h, k)] == material && !covered[at(i + h, k)];
+        }
+        if (!row_matches) break;
+      }
+
+      for (int r = i; r < i + h; ++r) {
+        for (int k = j; k < j + w; ++k) covered[at(r, k)] = 1;
+      }
+      rects.push_back({j, i, w, h, material});
+      j += w - 1;
+    }
+  }
+  return rects;
+}
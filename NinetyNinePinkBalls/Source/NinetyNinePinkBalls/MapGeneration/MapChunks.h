@@ -0,0 +1,289 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "FloorRects.h"
+#include "MapTypes.h"
+#include "WallGrid.h"
+
+// Geometry of a map built straight from its wall grid, in square chunks of
+// cells: one mesh and one set of collision boxes per chunk instead of one
+// component per wall and floor tile. Only depends on the grid, so the chunks
+// can be built on any thread and a chunk is rebuilt alone when its cells
+// change. A maze passes map_t::emitted_grid(), the chunks then hold the same
+// walls as its colliders.
+
+struct chunk_config_t {
+  int chunk_size = 32;
+  double cell_size = 500;
+  double wall_height = 300;
+  double wall_thickness = 20;
+  // Open edges between two rooms are doors, a lintel closes the wall above
+  // them. Without rooms there are no doors.
+  double door_height = 220;
+  double floor_thickness = 10;
+};
+
+struct chunk_box_t {
+  vector_t center;
+  vector_t extent;
+};
+
+struct chunk_uv_t {
+  double u, v;
+};
+
+// Vertices are relative to the chunk origin, UVs are world aligned with one
+// unit per cell. Triangles are wound so that (b - a) x (c - a) points out of
+// the face.
+struct chunk_mesh_t {
+  std::vector<vector_t> vertices;
+  std::vector<vector_t> normals;
+  std::vector<chunk_uv_t> uvs;
+  std::vector<int32_t> triangles;
+  // Simple collision of the chunk, one convex box each.
+  std::vector<chunk_box_t> boxes;
+
+  void clear() {
+    vertices.clear();
+    normals.clear();
+    uvs.clear();
+    triangles.clear();
+    boxes.clear();
+  }
+};
+
+class map_chunks_t {
+  // Shared with the builds running on other threads, see snapshot. Builds
+  // never read the pointer itself, it changes when the grid is copied.
+  std::shared_ptr<wall_grid_t> grid;
+  int width = 0;
+  int height = 0;
+  // Room of every cell, row-major, -1 for cells without floor. Empty when
+  // every cell is walkable and there are no doors.
+  std::vector<int> rooms;
+  chunk_config_t config;
+  int chunks_x = 0;
+  int chunks_y = 0;
+  std::vector<chunk_mesh_t> meshes;
+  std::vector<uint8_t> built;
+
+public:
+  map_chunks_t(wall_grid_t g, std::vector<int> r, const chunk_config_t& c)
+      : grid(std::make_shared<wall_grid_t>(std::move(g))), width(grid->get_width()), height(grid->get_height()),
+        rooms(std::move(r)), config(c) {
+    config.chunk_size = std::max(config.chunk_size, 1);
+    chunks_x = (width + config.chunk_size - 1) / config.chunk_size;
+    chunks_y = (height + config.chunk_size - 1) / config.chunk_size;
+    meshes.resize(static_cast<size_t>(chunks_x) * chunks_y);
+    built.resize(meshes.size(), 0);
+  }
+
+  [[nodiscard]] int chunk_count() const { return chunks_x * chunks_y; }
+  [[nodiscard]] int chunk_columns() const { return chunks_x; }
+  [[nodiscard]] int chunk_rows() const { return chunks_y; }
+  [[nodiscard]] const chunk_mesh_t& mesh(int chunk) const { return meshes[chunk]; }
+  [[nodiscard]] bool is_built(int chunk) const { return built[chunk]; }
+  [[nodiscard]] const chunk_config_t& get_config() const { return config; }
+  [[nodiscard]] const wall_grid_t& get_grid() const { return *grid; }
+  // Walls changed through here only show once the chunks_touching them are
+  // rebuilt. The grid is copied first while a snapshot of it is still held,
+  // so builds on other threads never see it change. Only one thread may
+  // change the grid and take snapshots.
+  [[nodiscard]] wall_grid_t& get_grid() {
+    if (grid.use_count() > 1) grid = std::make_shared<wall_grid_t>(*grid);
+    return *grid;
+  }
+
+  // The grid as it is now, for a build on another thread.
+  [[nodiscard]] std::shared_ptr<const wall_grid_t> snapshot() const { return grid; }
+
+  [[nodiscard]] grid_rect_t chunk_rect(int chunk) const {
+    const int x = chunk % chunks_x * config.chunk_size;
+    const int y = chunk / chunks_x * config.chunk_size;
+    return {x, y, std::min(config.chunk_size, width - x), std::min(config.chunk_size, height - y)};
+  }
+
+  [[nodiscard]] vector_t chunk_origin(int chunk) const {
+    const grid_rect_t rect = chunk_rect(chunk);
+    return vector_t{rect.x * config.cell_size, rect.y * config.cell_size, 0.0};
+  }
+
+  // Chunks whose mesh depends on the cells of `cells`. A chunk owns the
+  // north and west edges of its cells, so the chunks south and east of the
+  // rectangle are included for its south and east edges.
+  [[nodiscard]] std::vector<int> chunks_touching(const grid_rect_t& cells) const {
+    std::vector<int> chunks;
+    const int size = config.chunk_size;
+    const int x0 = std::max(cells.x - 1, 0) / size;
+    const int y0 = std::max(cells.y - 1, 0) / size;
+    const int x1 = std::min((cells.x + cells.width) / size, chunks_x - 1);
+    const int y1 = std::min((cells.y + cells.height) / size, chunks_y - 1);
+    for (int cy = y0; cy <= y1; ++cy) {
+      for (int cx = x0; cx <= x1; ++cx) chunks.push_back(cy * chunks_x + cx);
+    }
+    return chunks;
+  }
+
+  // Rebuilds the mesh of one chunk. Chunks only write their own mesh, any
+  // number of them can be built at the same time. Reads the current grid,
+  // the thread changing it has to wait for the build.
+  void build(int chunk) { build(chunk, *grid); }
+
+  // Same from a snapshot, while the grid may change.
+  void build(int chunk, const wall_grid_t& from) {
+    chunk_mesh_t& m = meshes[chunk];
+    m.clear();
+    const grid_rect_t rect = chunk_rect(chunk);
+    const vector_t origin = chunk_origin(chunk);
+    const double seg = config.cell_size;
+
+    // Floor, merged into rectangles over the chunk's cells.
+    std::vector<int> materials(static_cast<size_t>(rect.width) * rect.height, 0);
+    for (int i = 0; i < rect.height; ++i) {
+      for (int j = 0; j < rect.width; ++j) {
+        materials[static_cast<size_t>(i) * rect.width + j] = room(rect.y + i, rect.x + j) < 0 ? -1 : 0;
+      }
+    }
+    for (const floor_rect_t& r : merge_floor_cells(materials, rect.width, rect.height)) {
+      add_box(m, origin,
+        vector_t{(r.x + r.width / 2.0) * seg, (r.y + r.height / 2.0) * seg, -config.floor_thickness / 2},
+        vector_t{r.width * seg / 2, r.height * seg / 2, config.floor_thickness / 2}, true);
+    }
+
+    // The edges on the last line of the grid belong to the last chunks.
+    const int rows = rect.height + (rect.y + rect.height == from.get_height());
+    const int cols = rect.width + (rect.x + rect.width == from.get_width());
+    const double half = config.wall_thickness / 2;
+
+    // Horizontal edges, runs along each line.
+    for (int i = rect.y; i < rect.y + rows; ++i) {
+      for_each_run(rect.x, rect.x + rect.width, [&](int j) { return edge_kind(from, i, j, true); },
+        [&](int kind, int begin, int end) {
+          add_wall(m, origin, kind, vector_t{(begin + end) * seg / 2, i * seg, 0.0},
+            vector_t{(end - begin) * seg / 2 + half, half, 0.0});
+        });
+    }
+
+    // Vertical edges, runs down each line.
+    for (int j = rect.x; j < rect.x + cols; ++j) {
+      for_each_run(rect.y, rect.y + rect.height, [&](int i) { return edge_kind(from, i, j, false); },
+        [&](int kind, int begin, int end) {
+          add_wall(m, origin, kind, vector_t{j * seg, (begin + end) * seg / 2, 0.0},
+            vector_t{half, (end - begin) * seg / 2 + half, 0.0});
+        });
+    }
+    built[chunk] = 1;
+  }
+
+  // Frees the mesh of a chunk once it has been uploaded, the grid is enough
+  // to build it again.
+  void release(int chunk) {
+    meshes[chunk] = chunk_mesh_t{};
+    built[chunk] = 0;
+  }
+
+  void build_all() {
+    for (int chunk = 0; chunk < chunk_count(); ++chunk) build(chunk);
+  }
+
+private:
+  enum { edge_open = 0, edge_wall = 1, edge_door = 2 };
+
+  [[nodiscard]] int room(int i, int j) const {
+    return rooms.empty() ? 0 : rooms[static_cast<size_t>(i) * width + j];
+  }
+
+  // Edge on the north (horizontal) or west side of the cell (i, j), (i, j)
+  // may be one past the last row or column.
+  [[nodiscard]] int edge_kind(const wall_grid_t& from, int i, int j, bool horizontal) const {
+    const bool is_wall = horizontal ? from.horizontal().test(i, j) : from.vertical().test(i, j);
+    if (is_wall) return edge_wall;
+    if (rooms.empty()) return edge_open;
+
+    const int pi = horizontal ? i - 1 : i;
+    const int pj = horizontal ? j : j - 1;
+    if (!from.in_bounds(pi, pj) || !from.in_bounds(i, j)) return edge_open;
+    const int a = room(pi, pj);
+    const int b = room(i, j);
+    return a >= 0 && b >= 0 && a != b ? edge_door : edge_open;
+  }
+
+  // Calls emit(kind, begin, end) for every run of the same non open kind in
+  // [begin, end).
+  template<typename Kind, typename Emit>
+  static void for_each_run(int begin, int end, Kind kind_at, Emit emit) {
+    for (int k = begin; k < end;) {
+      const int kind = kind_at(k);
+      int run = k + 1;
+      while (run < end && kind_at(run) == kind) ++run;
+      if (kind != edge_open) emit(kind, k, run);
+      k = run;
+    }
+  }
+
+  // Full height wall, or the lintel above a door.
+  void add_wall(chunk_mesh_t& m, const vector_t& origin, int kind, vector_t center, vector_t extent) const {
+    const double bottom = kind == edge_door ? config.door_height : 0.0;
+    center.Z = (bottom + config.wall_height) / 2;
+    extent.Z = (config.wall_height - bottom) / 2;
+    add_box(m, origin, center, extent, false);
+  }
+
+  // Box collider and its faces, the bottom face is never seen. Floors only
+  // show their top face.
+  void add_box(chunk_mesh_t& m, const vector_t& origin, const vector_t& center, const vector_t& extent, bool top_only) const {
+    m.boxes.push_back({sub(center, origin), extent});
+
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int sign = -1; sign <= 1; sign += 2) {
+        if (axis == 2 && sign < 0) continue;
+        if (top_only && axis != 2) continue;
+
+        // Corners of the face, going around it.
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        vector_t corners[4];
+        const int su[4] = {-1, 1, 1, -1};
+        const int sv[4] = {-1, -1, 1, 1};
+        for (int c = 0; c < 4; ++c) {
+          double p[3] = {center.X, center.Y, center.Z};
+          const double e[3] = {extent.X, extent.Y, extent.Z};
+          p[axis] += sign * e[axis];
+          p[u] += su[c] * e[u];
+          p[v] += sv[c] * e[v];
+          corners[c] = vector_t{p[0], p[1], p[2]};
+        }
+        double n[3] = {0, 0, 0};
+        n[axis] = sign;
+        add_quad(m, origin, corners, vector_t{n[0], n[1], n[2]}, u, v);
+      }
+    }
+  }
+
+  void add_quad(chunk_mesh_t& m, const vector_t& origin, const vector_t (&corners)[4], const vector_t& normal, int u, int v) const {
+    const int32_t first = static_cast<int32_t>(m.vertices.size());
+    for (const vector_t& corner : corners) {
+      const double p[3] = {corner.X, corner.Y, corner.Z};
+      m.vertices.push_back(sub(corner, origin));
+      m.normals.push_back(normal);
+      m.uvs.push_back({p[u] / config.cell_size, p[v] / config.cell_size});
+    }
+
+    // Corners go u then v, which faces +axis for the (u, v) = (axis + 1,
+    // axis + 2) basis.
+    const double facing = normal.X + normal.Y + normal.Z;
+    if (facing > 0) {
+      m.triangles.insert(m.triangles.end(), {first, first + 1, first + 2, first, first + 2, first + 3});
+    } else {
+      m.triangles.insert(m.triangles.end(), {first, first + 2, first + 1, first, first + 3, first + 2});
+    }
+  }
+
+  [[nodiscard]] static vector_t sub(const vector_t& a, const vector_t& b) {
+    return vector_t{a.X - b.X, a.Y - b.Y, a.Z - b.Z};
+  }
+};
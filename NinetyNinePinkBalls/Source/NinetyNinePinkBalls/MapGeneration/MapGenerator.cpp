@@ -1,5 +1,15 @@
 ﻿#include "MapGenerator.h"
 
+#include "NinetyNinePinkBalls.h"
+#include "PavagePieceCatalog.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/CollisionProfile.h"
+#include "ProceduralMeshComponent.h"
+#include "Kismet/GameplayStatics.h"
+#include "PhysicsEngine/PhysicsHandleComponent.h"
+
 #include <vector>
 #include <array>
 #include <unordered_set>
@@ -13,909 +23,1185 @@
 #include <fstream>
 #include <iostream>
 
-using vector_t = FVector;
-
+#include "MapChunks.h"
+#include "Maze.h"
+#include "Pavage.h"
 
-struct point_t {
-  int x, y;
-
-  bool operator==(const point_t& oth) const {
-    return x == oth.x && y == oth.y;
-  }
+// Everything the background task computes, spawned on the game thread once it's done
+struct FMapLayout
+{
+	collider_buffer_t Walls;
+	std::vector<floor_rect_t> Floor;
+	// Built chunk meshes, only with BuildChunkMeshes
+	std::shared_ptr<map_chunks_t> Chunks;
+	// Maze maps only, kept by the generator to regenerate regions of it
+	std::shared_ptr<map_t> Maze;
+	FVector PlayerStartPosition = FVector::Zero();
+	FVector GhostPosition = FVector::Zero();
+	TArray<FVector> BallPositions;
 };
 
-namespace std {
-  template<>
-  struct hash<point_t> {
-    size_t operator()(const point_t& p) const {
-      return std::hash<int>()(p.x) ^ (std::hash<int>()(p.y) << 1);
-    }
-  };
+namespace
+{
+   const FVector MAP_OFFSET = {200.f, 200.f, 0.f};
+   
+   // Instances are added to their component in batches of this size, so a frame
+   // never rebuilds an instance tree much past the spawn budget
+   constexpr int32 INSTANCE_BATCH_SIZE = 256;
+   
+   // Rows of the streamed maze waiting in the spawn queue, more are generated below that
+   constexpr int32 STREAMED_ROWS_AHEAD = 16;
+
+   maze_algorithm ToMazeAlgorithm(EMazeAlgorithm Algorithm)
+   {
+     switch (Algorithm)
+     {
+       case EMazeAlgorithm::Kruskal: return maze_algorithm::kruskal;
+       case EMazeAlgorithm::Wilson: return maze_algorithm::wilson;
+       case EMazeAlgorithm::Backtracker: return maze_algorithm::backtracker;
+       default: return maze_algorithm::prim;
+     }
+   }
+
+   // Copy of every option the layout depends on, the background task never reads the actor
+   struct FMapGenerationSettings
+   {
+     bool UsesPavage = true;
+     map_config_t Config;
+     pavage::door_config_t Doors;
+     std::vector<pavage::piece_t> Pieces;
+     pavage::solver_kind Solver = pavage::solver_kind::scan;
+     // Only used with more than one solve
+     pavage::portfolio_config_t Portfolio;
+     ball_placement_config_t Balls;
+     std::vector<double> BallDensityByPieceType;
+     int32 GhostMinPathDistance = 0;
+     int32 GhostMaxPathDistance = 0;
+     bool BuildChunkMeshes = false;
+     // Chunks are built when the player gets close instead of all at once
+     bool StreamChunks = false;
+     chunk_config_t Chunks;
+   };
+
+   void CalculatePositionsWithMap(const FMapGenerationSettings& Settings, FMapLayout& Layout)
+   {
+     Layout.Maze = std::make_shared<map_t>(Settings.Config);
+     const map_t& map = *Layout.Maze;
+     if (Settings.BuildChunkMeshes)
+     {
+       Layout.Chunks = std::make_shared<map_chunks_t>(map.emitted_grid(), std::vector<int>{}, Settings.Chunks);
+     }
+     else
+     {
+       Layout.Walls = map.get_walls();
+       Layout.Floor = map.retrieve_floor();
+     }
+     
+     const spawn_points_t spawns = map.retrieve_spawn_points(Settings.GhostMinPathDistance, Settings.GhostMaxPathDistance);
+     Layout.PlayerStartPosition = spawns.player;
+     Layout.GhostPosition = spawns.ghost;
+     
+     for (const vector_t& ball : map.retrieve_balls(Settings.Balls))
+     {
+       Layout.BallPositions.Add(ball);
+     }
+   }
+
+   void CalculatePositionsWithPavage(const FMapGenerationSettings& Settings, FMapLayout& Layout)
+   {
+     const map_config_t& config = Settings.Config;
+     auto solve = [&]
+     {
+       if (Settings.Portfolio.solves <= 1)
+         return pavage::map_t::solved(config.width, config.height, Settings.Pieces, config.seed, Settings.Solver);
+       pavage::portfolio_result_t result = pavage::solve_portfolio(config.width, config.height, Settings.Pieces, config.seed, Settings.Portfolio);
+       UE_LOG(LogNinetyNinePinkBalls, Log, TEXT("Pavage solve %d of %d kept, %.0f cells covered, %d completed"),
+         result.solve, Settings.Portfolio.solves, result.score, result.completed);
+       return std::move(result.placement);
+     };
+     pavage::map_t map {solve(), config.segment_length, config.seed, config.merge_walls, Settings.Doors};
+     if (Settings.BuildChunkMeshes)
+     {
+       Layout.Chunks = std::make_shared<map_chunks_t>(map.retrieve_wall_grid(), map.room_map(), Settings.Chunks);
+     }
+     else
+     {
+       Layout.Walls = map.get_walls();
+       Layout.Floor = map.retrieve_floor();
+     }
+     
+     const spawn_points_t spawns = map.retrieve_spawn_points(Settings.GhostMinPathDistance, Settings.GhostMaxPathDistance);
+     Layout.PlayerStartPosition = spawns.player;
+     Layout.GhostPosition = spawns.ghost + MAP_OFFSET.X * FVector::UpVector;
+     
+     for (const vector_t& ball : map.retrieve_balls(Settings.Balls, Settings.BallDensityByPieceType))
+     {
+       Layout.BallPositions.Add(ball);
+     }
+   }
 }
 
-inline constexpr std::array<point_t, 4> direction = {{
-  {-1, 0}, {1, 0}, {0, 1}, {0, -1}
-}};
-
-struct cell_t {
-  bool n = true, s = true, e = true, w = true;
-
-  [[nodiscard]] bool is_wall(int pos) const {
-    switch (pos) {
-      case 0: return n;
-      case 1: return s;
-      case 2: return e;
-      case 3: return w;
-      default: return false;
-    }
-  }
-
-  [[nodiscard]] bool has_single_wall() const {
-    int count = 0;
-    if (n) count++;
-    if (s) count++;
-    if (e) count++;
-    if (w) count++;
-    return count == 1;
-  }
-};
-
-enum class wall_orientation { H, V };
-
-struct collider_t {
-  vector_t centroid;
-  wall_orientation orientation;
-  double length;
-
-  collider_t(const vector_t& c, wall_orientation o, double l)
-      : centroid(c), orientation(o), length(l) {}
-
-  [[nodiscard]] std::array<vector_t, 2> get_endpoints() const {
-    if (orientation == wall_orientation::H) {
-      return {{
-        {centroid.X - length / 2, centroid.Y, centroid.Z},
-        {centroid.X + length / 2, centroid.Y, centroid.Z}
-      }};
-    } else {
-      return {{
-        {centroid.X, centroid.Y - length / 2, centroid.Z},
-        {centroid.X, centroid.Y + length / 2, centroid.Z}
-      }};
-    }
-  }
-
-  [[nodiscard]] double get_angle() const {
-    return (orientation == wall_orientation::H) ? 0.0 : std::numbers::pi / 2;
-  }
-};
-
-using wall_data = std::tuple<double, double, wall_orientation>;
-
-namespace std {
-  template<>
-  struct hash<wall_data> {
-    size_t operator()(const wall_data& key) const {
-      size_t h1 = std::hash<double>()(std::get<0>(key));
-      size_t h2 = std::hash<double>()(std::get<1>(key));
-      size_t h3 = std::hash<int>()(static_cast<int>(std::get<2>(key)));
-      return h1 ^ (h2 << 1) ^ (h3 << 2);
-    }
-  };
-
-  template<>
-  struct equal_to<wall_data> {
-    bool operator()(const wall_data& lhs, const wall_data& rhs) const {
-      return std::get<0>(lhs) == std::get<0>(rhs) &&
-             std::get<1>(lhs) == std::get<1>(rhs) &&
-             std::get<2>(lhs) == std::get<2>(rhs);
-    }
-  };
+AMapGenerator::AMapGenerator()
+{
+	// Only ticks while the spawn queue isn't empty
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.bStartWithTickEnabled = false;
 }
 
-struct map_config_t {
-  int width;
-  int height;
-  int segment_length;
-  int threshold;
-};
-
-
-class map_t {
-private:
-  int segment_length;
-  int width;
-  int height;
-  int threshold = 30;
-  std::vector<std::vector<cell_t>> grid;
-  vector_t start;
-  std::vector<std::shared_ptr<collider_t>> walls;
-
-  std::mt19937 rng{ std::random_device{}() };
-
-public:
-  [[nodiscard]] vector_t centroid() const { return start; }
-
-  vector_t retrieve_safe_point() {
-    std::uniform_int_distribution<int> dist_x(0, width - 1);
-    std::uniform_int_distribution<int> dist_y(0, height - 1);
-
-    int rx = dist_x(rng);
-    int ry = dist_y(rng);
-
-    std::uniform_int_distribution<int> offset(
-      -segment_length * 0.75 / 2, segment_length * 0.75 / 2);
-
+bool AMapGenerator::IsMapReady() const
+{
+	return _isMapReady;
+}
 
-    return vector_t{
-      rx * segment_length + segment_length / 2.0 + offset(rng),
-      ry * segment_length + segment_length / 2.0 + offset(rng),
-      0.0
-    };
-  }
+float AMapGenerator::GetSpawnProgress() const
+{
+	// The streamed maze isn't queued in full, its rows tell how far it got
+	if (_mazeStream)
+	{
+		return static_cast<float>(_mazeStream->current_row()) / MapHeight;
+	}
+	return _spawnQueueTotal > 0 ? 1.f - static_cast<float>(_spawnQueue.Num()) / _spawnQueueTotal : 0.f;
+}
 
-  std::vector<std::shared_ptr<collider_t>>& get_walls() { return walls; }
-
-  map_t(const map_config_t& config)
-      : width(config.width), height(config.height), grid(config.height, std::vector<cell_t>(config.height)), 
-        segment_length(config.segment_length), threshold(config.threshold) {
-    prim(
-      {std::uniform_int_distribution<int>(0, width - 1)(rng),
-      std::uniform_int_distribution<int>(0, height - 1)(rng)}
-    );
-    random_remove_wall();
-    generate_colliders();
-  }
+FVector AMapGenerator::GetPlayerStartPosition() const
+{
+	return _playerStartPosition + FVector::UpVector * 200.f;
+}
 
-  [[nodiscard]] std::string latex() const {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(2);
-
-    oss << "\\documentclass[margin=5mm,tikz]{standalone}\n"
-        << "\\usepackage{tikz}\n"
-        << "\\begin{document}\n";
-
-    oss << "\\begin{tikzpicture}[scale=0.5]\n";
-    for (const auto& wall : walls) {
-      const auto& c = wall->centroid;
-      double half = wall->length / 2.0;
-
-      if (wall->orientation == wall_orientation::H) {
-        oss << "\\draw (" << c.X - half << "," << c.Y << ") -- ("
-            << c.X + half << "," << c.Y << ");\n";
-      } else {
-        oss << "\\draw (" << c.X << "," << c.Y - half << ") -- ("
-            << c.X << "," << c.Y + half << ");\n";
-      }
-    }
+void AMapGenerator::BeginPlay()
+{
+  Super::BeginPlay();
+  GenerateMap(UseRandomSeed ? FMath::Rand() : Seed);
+}
 
-    oss << "\\end{tikzpicture}\n\\end{document}";
+void AMapGenerator::RegenerateMap(int32 NewSeed)
+{
+	RetireSpawnedMap();
+	GenerateMap(NewSeed);
+}
 
-    return oss.str();
+map_config_t AMapGenerator::GetConfig() const
+{
+  map_config_t config;
+  config.height = MapHeight;
+  config.width = MapWidth;
+  config.segment_length = TileSize;
+  config.threshold = Threshold;
+  config.algorithm = ToMazeAlgorithm(MazeAlgorithm);
+  config.prune_window = PruneWindow;
+  config.merge_walls = MergeCollinearWalls;
+  config.seed = static_cast<uint32>(_activeSeed);
+  config.tile_size = MazeTileSize;
+  config.threads = MazeThreads;
+  for (const FMazePruneRegion& region : PruneRegions)
+  {
+    config.prune_regions.push_back({region.Min.X, region.Min.Y, region.Size.X, region.Size.Y, region.Window, region.Threshold});
   }
+  return config;
+}
 
-private:
-  void prim(point_t s) {
-    std::vector<std::array<int, 5>> queue;
-    std::unordered_set<point_t> visited;
-
-    visited.insert(s);
-
-    for (int i = 0; i < direction.size(); ++i) {
-      const auto& dir = direction[i];
-      queue.push_back({s.x + dir.x, s.y + dir.y, i, s.x, s.y});
-    }
-
-    while(!queue.empty()) {
-      std::uniform_int_distribution<int> dist(0, queue.size() - 1);
-      size_t idx = dist(rng);
-
-      auto wall = queue[idx];
-      queue.erase(queue.begin() + idx);
+int32 AMapGenerator::GetGhostMaxPathDistance() const
+{
+	return GhostMaxPathDistance > 0 ? GhostMaxPathDistance : MAX_int32;
+}
 
-      int nx = wall[0];
-      int ny = wall[1];
-      int dir = wall[2];
-      int px = wall[3];
-      int py = wall[4];
+ball_placement_config_t AMapGenerator::GetBallConfig() const
+{
+	return {_ballCount, BallMinDistance, BallWallClearance};
+}
 
-      point_t next{nx, ny};
+void AMapGenerator::SetMapReady()
+{
+	_isMapReady = true;
+	OnMapReady.Broadcast();
+}
 
-      if (nx >= 0 && nx < width && ny >= 0 && ny < height &&
-          visited.find(next) == visited.end()) {
-        visited.insert(next);
+void AMapGenerator::GenerateMap(int32 MapSeed)
+{
+	_activeSeed = MapSeed;
+	const int32 generation = ++_mapGeneration;
+	UE_LOG(LogNinetyNinePinkBalls, Log, TEXT("Generating map with seed %d"), _activeSeed);
+	_meshStream.Initialize(HashCombine(GetTypeHash(_activeSeed), 0x3E5Du));
+	
+	// Rows are queued as they are generated, there is no layout to compute ahead
+	if (!UsesPavage && StreamMazeRows)
+	{
+		ClearRetiredMap();
+		SpawnStreamedWalls();
+		// Every cell has floor, a single rectangle covers it without holding the grid
+		SpawnFloor({floor_rect_t{0, 0, MapWidth, MapHeight, 0}});
+		PlaceObstacle();
+		SpawnBalls();
+		ReuseRetiredElements();
+		StartSpawnQueue();
+		return;
+	}
+	
+	FMapGenerationSettings settings;
+	settings.UsesPavage = UsesPavage;
+	settings.Config = GetConfig();
+	settings.Config.colliders = !BuildChunkMeshes;
+	settings.Doors.spanning_tree = SpanningTreeDoors;
+	settings.Doors.loop_fraction = LoopDoorFraction;
+	if (UsesPavage)
+	{
+		// Already expanded for the built-in pieces, the catalog's are expanded here on the game thread
+		settings.Pieces = PieceCatalog ? PieceCatalog->ToPieces() : pavage::pieces;
+		if (settings.Pieces.empty())
+		{
+			UE_LOG(LogNinetyNinePinkBalls, Warning, TEXT("%s has no piece that can be placed, using the built-in pieces"), *GetNameSafe(PieceCatalog));
+			settings.Pieces = pavage::pieces;
+		}
+	}
+	settings.Solver = PavageSolver == EPavageSolver::Frontier ? pavage::solver_kind::frontier : pavage::solver_kind::scan;
+	settings.Portfolio.solves = PavagePortfolioSolves;
+	settings.Portfolio.threads = PavagePortfolioThreads;
+	settings.Portfolio.budget = std::chrono::milliseconds(PavageSolveBudgetMs);
+	settings.Portfolio.solver = settings.Solver;
+	settings.Balls = GetBallConfig();
+	settings.GhostMinPathDistance = GhostMinPathDistance;
+	settings.GhostMaxPathDistance = GetGhostMaxPathDistance();
+	settings.BuildChunkMeshes = BuildChunkMeshes;
+	settings.StreamChunks = StreamChunks;
+	settings.Chunks.chunk_size = ChunkSize;
+	settings.Chunks.cell_size = TileSize;
+	settings.Chunks.wall_height = WallHeight;
+	settings.Chunks.wall_thickness = WallThickness;
+	settings.Chunks.door_height = DoorHeight;
+	for (const TPair<int32, float>& density : BallDensityByPieceType)
+	{
+		if (density.Key < 0) continue;
+		if (density.Key >= static_cast<int32>(settings.BallDensityByPieceType.size())) settings.BallDensityByPieceType.resize(density.Key + 1, 1.0);
+		settings.BallDensityByPieceType[density.Key] = density.Value;
+	}
+	
+	// The layout is computed on a worker, the game thread keeps rendering and only
+	// creates the components once it's done
+	TWeakObjectPtr<AMapGenerator> weakThis(this);
+	Async(EAsyncExecution::ThreadPool, [settings = MoveTemp(settings), weakThis, generation]()
+	{
+		auto layout = std::make_shared<FMapLayout>();
+		if (settings.UsesPavage)
+		{
+			CalculatePositionsWithPavage(settings, *layout);
+		}
+		else
+		{
+			CalculatePositionsWithMap(settings, *layout);
+		}
+		if (layout->Chunks && !settings.StreamChunks)
+		{
+			// Chunks only write their own mesh
+			ParallelFor(layout->Chunks->chunk_count(), [&layout](int32 Chunk)
+			{
+				layout->Chunks->build(Chunk);
+			});
+		}
+		
+		AsyncTask(ENamedThreads::GameThread, [weakThis, layout, generation]()
+		{
+			AMapGenerator* generator = weakThis.Get();
+			// Regenerated again while this layout was computed
+			if (generator && generator->_mapGeneration == generation)
+			{
+				generator->OnLayoutReady(*layout);
+			}
+		});
+	});
+}
 
-        remove_wall(point_t{px, py}, next, dir);
+void AMapGenerator::OnLayoutReady(const FMapLayout& Layout)
+{
+	ClearRetiredMap();
+	
+	_playerStartPosition = Layout.PlayerStartPosition;
+	_ghostPosition = Layout.GhostPosition;
+	_ballPositions = Layout.BallPositions;
+	
+	_maze = Layout.Maze;
+	_chunks = Layout.Chunks;
+	if (_chunks)
+	{
+		_chunkComponents.SetNum(_chunks->chunk_count());
+		if (StreamChunks)
+		{
+			_chunkStates.Init(EChunkState::Unloaded, _chunks->chunk_count());
+		}
+		else
+		{
+			for (int32 chunk = 0; chunk < _chunks->chunk_count(); ++chunk)
+			{
+				EnqueueChunk(chunk);
+			}
+		}
+	}
+	else
+	{
+		SpawnFloor(Layout.Floor);
+		SpawnWalls(Layout.Walls);
+	}
+	PlaceObstacle();
+	SpawnBalls();
+	if (!_chunkStates.IsEmpty())
+	{
+		UpdateStreamedChunks();
+	}
+	ReuseRetiredElements();
+	
+	StartSpawnQueue();
+}
 
-        for (int i = 0; i < direction.size(); ++i) {
-          const auto& dirc = direction[i];
-          queue.push_back({nx + dirc.x, ny + dirc.y, i, nx, ny});
-        }
-      }
-    }
-  }
+void AMapGenerator::RetireSpawnedMap()
+{
+	_isMapReady = false;
+	_spawnQueue.Reset();
+	_spawnQueueTotal = 0;
+	
+	// Chunks neither load nor unload until the next map replaces them, the ones still building
+	// are dropped by their generation
+	_chunkStates.Reset();
+	_activeChunks.Reset();
+	_staleChunks.Reset();
+	_chunksBuilding = 0;
+	_maze.reset();
+	_mazeStream.reset();
+	_streamedWallsQueued = 0;
+}
 
-  void random_remove_wall() {
-    std::vector<std::vector<int>> density;
-
-    for (size_t si = 0; si < grid.size() - 4; ++si) {
-      for (size_t sj = 0; sj < grid[si].size() - 4; ++sj) {
-        int wall_count = 0;
-        for (size_t i = si; i < si + 4; ++i) {
-          for (size_t j = sj; j < sj + 4; ++j) {
-            wall_count += grid[i][j].n + grid[i][j].s + grid[i][j].e + grid[i][j].w;
-          }
-        }
-        density.push_back({static_cast<int>(si), static_cast<int>(sj), wall_count});
-      }
-    }
+void AMapGenerator::ClearRetiredMap()
+{
+	// Matched against the new layout, queued right after
+	for (const TPair<FMapElementKey, TWeakObjectPtr<UStaticMeshComponent>>& element : _meshElements)
+	{
+		_retiredElements.Add(element.Key, element.Value);
+	}
+	_meshElements.Reset();
+	
+	for (const TPair<TObjectPtr<UStaticMesh>, TObjectPtr<UHierarchicalInstancedStaticMeshComponent>>& instanced : _instancedMeshes)
+	{
+		instanced.Value->ClearInstances();
+	}
+	for (const TWeakObjectPtr<UProceduralMeshComponent>& rect : _floorRects)
+	{
+		if (rect.IsValid())
+		{
+			rect->DestroyComponent();
+		}
+	}
+	_floorRects.Reset();
+	
+	for (TObjectPtr<UProceduralMeshComponent>& component : _chunkComponents)
+	{
+		if (component)
+		{
+			component->ClearAllMeshSections();
+			component->ClearCollisionConvexMeshes();
+			_chunkPool.Push(component);
+		}
+	}
+	_chunkComponents.Reset();
+	_chunkBalls.Reset();
+	_chunks.reset();
+	
+	_ballActors.Add(_hauntedBall);
+	for (const TWeakObjectPtr<AActor>& ball : _ballActors)
+	{
+		if (AActor* actor = ball.Get())
+		{
+			actor->SetActorHiddenInGame(true);
+			actor->SetActorEnableCollision(false);
+			_actorPool.Add(actor);
+		}
+	}
+	_ballActors.Reset();
+	_hauntedBall.Reset();
+}
 
-    for (const auto& d : density) {
-      if (d[2] > threshold) {
-        std::uniform_int_distribution<int> dist_i(d[0], d[0] + 3);
-        std::uniform_int_distribution<int> dist_j(d[1], d[1] + 3);
-        int ri = dist_i(rng);
-        int rj = dist_j(rng);
-
-        std::vector<int> possible_walls;
-        if (grid[ri][rj].n) possible_walls.push_back(0);
-        if (grid[ri][rj].s) possible_walls.push_back(1);
-        if (grid[ri][rj].e) possible_walls.push_back(2);
-        if (grid[ri][rj].w) possible_walls.push_back(3);
-
-        if (!possible_walls.empty()) {
-          std::uniform_int_distribution<int> dist_wall(0, possible_walls.size() - 1);
-          int wall_dir = possible_walls[dist_wall(rng)];
-
-          point_t p1{ri, rj};
-          point_t p2{ri + direction[wall_dir].x, rj + direction[wall_dir].y};
-          
-          if (p2.x >= 0 && p2.x < width && p2.y >= 0 && p2.y < height)
-            remove_wall(p1, p2, wall_dir);
-        }
-      }
-    }
-  }
+void AMapGenerator::ReuseRetiredElements()
+{
+	if (_retiredElements.IsEmpty()) return;
+	
+	_spawnQueue.RemoveAllSwap([this](const FPendingMapElement& Element)
+	{
+		if (!Element.Mesh || Element.Instanced || !Element.Extent.IsZero()) return false;
+		
+		const FMapElementKey key = MakeElementKey(Element);
+		TWeakObjectPtr<UStaticMeshComponent> component;
+		if (!_retiredElements.RemoveAndCopyValue(key, component) || !component.IsValid()) return false;
+		
+		// Registered static components only take a new mesh once unregistered
+		if (component->GetStaticMesh() != Element.Mesh)
+		{
+			component->UnregisterComponent();
+			component->SetStaticMesh(Element.Mesh);
+			component->RegisterComponent();
+		}
+		_meshElements.Add(key, component);
+		if (Element.Streamed)
+		{
+			--_streamedWallsQueued;
+		}
+		return true;
+	});
+	
+	// Unregistered, they cost nothing until they are moved to a new element
+	for (const TPair<FMapElementKey, TWeakObjectPtr<UStaticMeshComponent>>& retired : _retiredElements)
+	{
+		if (UStaticMeshComponent* component = retired.Value.Get())
+		{
+			component->UnregisterComponent();
+			_meshPool.Add(component);
+		}
+	}
+	_retiredElements.Reset();
+}
 
-  void remove_wall(point_t p1, point_t p2, int dir) {
-    if (dir == 0) {
-      grid[p1.x][p1.y].n = false;
-      grid[p2.x][p2.y].s = false;
-    } else if (dir == 1) {
-      grid[p1.x][p1.y].s = false;
-      grid[p2.x][p2.y].n = false;
-    } else if (dir == 2) {
-      grid[p1.x][p1.y].e = false;
-      grid[p2.x][p2.y].w = false;
-    } else if (dir == 3) {
-      grid[p1.x][p1.y].w = false;
-      grid[p2.x][p2.y].e = false;
-    }
-  }
+FMapElementKey AMapGenerator::MakeElementKey(const FPendingMapElement& Element)
+{
+	FMapElementKey key;
+	key.Floor = Element.Floor;
+	key.Position = FIntVector(FMath::RoundToInt32(Element.Position.X), FMath::RoundToInt32(Element.Position.Y), FMath::RoundToInt32(Element.Position.Z));
+	key.Yaw = FMath::RoundToInt32(Element.Rotation.Yaw);
+	key.LengthScale = FMath::RoundToInt32(Element.LengthScale * 1000.f);
+	return key;
+}
 
-  void generate_colliders() {
-    std::unordered_set<wall_data> unique_walls;
-    walls.clear();
-
-    auto is_border = [this](size_t i, size_t j) {
-      return i == 0 || j == 0 || i == height - 1 || j == width - 1;
-    };
-
-    for (size_t i = 0; i < grid.size(); ++i) {
-      for (size_t j = 0; j < grid[i].size(); ++j) {
-        const auto& cell = grid[i][j];
-        if (cell.has_single_wall() && !is_border(i, j))
-          continue;
-
-        double iw = i * segment_length;
-        double jw = j * segment_length;
-
-        if (cell.n || i == 0) {
-          unique_walls.insert({
-            jw + segment_length / 2.0, iw, 
-            wall_orientation::H});
-        }
-        if (cell.s || i == height - 1) {
-          unique_walls.insert({
-            jw + segment_length / 2.0, iw + segment_length, 
-            wall_orientation::H});
-        }
-        if (cell.e || j == width - 1) {
-          unique_walls.insert({
-            jw + segment_length, iw + segment_length / 2.0, 
-            wall_orientation::V});
-        }
-        if (cell.w || j == 0) {
-          unique_walls.insert({
-            jw, iw + segment_length / 2.0, 
-            wall_orientation::V});
-        }
-      }
-    }
+AActor* AMapGenerator::AcquireActor(TSubclassOf<AActor> ActorClass, const FVector& Position)
+{
+	for (int32 index = _actorPool.Num() - 1; index >= 0; --index)
+	{
+		AActor* actor = _actorPool[index];
+		if (!IsValid(actor))
+		{
+			_actorPool.RemoveAtSwap(index);
+			continue;
+		}
+		if (actor->GetClass() != ActorClass) continue;
+		
+		_actorPool.RemoveAtSwap(index);
+		actor->SetActorLocation(Position, false, nullptr, ETeleportType::ResetPhysics);
+		actor->SetActorHiddenInGame(false);
+		actor->SetActorEnableCollision(true);
+		return actor;
+	}
+	return GetWorld()->SpawnActor(ActorClass, &Position);
+}
 
-    for (const auto& wall : unique_walls) {
-      double x = std::get<0>(wall);
-      double y = std::get<1>(wall);
-      wall_orientation o = std::get<2>(wall);
+FPendingMapElement& AMapGenerator::EnqueueMapElement(UStaticMesh* Mesh, const FVector& Position, const FRotator& Rotation, float LengthScale, bool Instanced)
+{
+	FPendingMapElement& element = _spawnQueue.AddDefaulted_GetRef();
+	element.Mesh = Mesh;
+	element.Position = Position;
+	element.Rotation = Rotation;
+	element.LengthScale = LengthScale;
+	element.Instanced = Instanced;
+	return element;
+}
 
-      walls.push_back(std::make_shared<collider_t>(
-        vector_t{x, y, 0.0},
-        o,
-        static_cast<double>(segment_length)));
-    }
-  }
-};
+void AMapGenerator::EnqueueFloorRect(UStaticMesh* Mesh, const floor_rect_t& Rect)
+{
+	// Bounds of the tiles the rectangle replaces, from the bounds of a single tile
+	const FBoxSphereBounds bounds = Mesh->GetBounds();
+	const FVector tileScale(Scale, Scale, 1.f);
+	const FVector min = FVector(TileSize * Rect.x, TileSize * Rect.y, 0.f) + MAP_OFFSET * Scale + (bounds.Origin - bounds.BoxExtent) * tileScale;
+	const FVector size = FVector(TileSize * (Rect.width - 1), TileSize * (Rect.height - 1), 0.f) + 2 * bounds.BoxExtent * tileScale;
+	
+	FPendingMapElement& element = _spawnQueue.AddDefaulted_GetRef();
+	element.Mesh = Mesh;
+	element.Extent = size / 2;
+	element.Position = min + element.Extent;
+}
 
-namespace pavage {
-  using shape_t = std::vector<std::pair<int, int>>;
-  using const_ref_shape_t = const shape_t&;
-
-  struct piece_t {
-    shape_t cells;
-    int type;
-    int max_count;
-    int used_count = 0;
-
-    auto get_variants() const {
-      std::vector<shape_t> variants;
-      auto current = cells;
-      
-      for (int flip = 0; flip < 2; ++flip) {
-        for (int rot = 0; rot < 4; ++rot) {
-          int minx = INT_MAX, miny = INT_MAX;
-          for (auto [x, y] : current) {
-            minx = std::min(minx, x);
-            miny = std::min(miny, y);
-          }
-
-          shape_t normalized;
-          for (auto [x, y] : current) {
-            normalized.push_back({ x - minx, y - miny });
-          }
-
-          std::sort(normalized.begin(), normalized.end());
-          if (std::find(variants.begin(), variants.end(), normalized) == variants.end()) {
-            variants.push_back(normalized);
-          }
-          for (auto& [x, y] : current) { std::tie(x, y) = std::make_pair(-y, x); }
-        }
-        for (auto& [x, y] : current) { x = -x; }
-      }
-  
-      return variants;
-    }
-  };
-
-  struct collider_t {
-    vector_t centroid;
-    wall_orientation orientation;
-    double length;
-    bool is_door;
-
-    collider_t(vector_t c, wall_orientation o, double l, bool d)
-      : centroid(c), orientation(o), length(l), is_door(d) {}
-
-    [[nodiscard]] std::array<vector_t, 2> get_endpoints() const {
-      if (orientation == wall_orientation::H) {
-        return {{
-          { centroid.X - length / 2, centroid.Y, centroid.Z },
-          { centroid.X + length / 2, centroid.Y, centroid.Z }
-        }};
-      } else {
-        return {{
-          { centroid.X, centroid.Y - length / 2, centroid.Z },
-          { centroid.X, centroid.Y + length / 2, centroid.Z }
-        }};
-      }
-    }
+UStaticMesh* AMapGenerator::PickMesh(const TArray<UStaticMesh*>& Meshes)
+{
+	return Meshes.IsEmpty() ? nullptr : Meshes[_meshStream.RandRange(0, Meshes.Num() - 1)];
+}
 
-    [[nodiscard]] double get_angle() const {
-      return (orientation == wall_orientation::H) ? 0.0 : std::numbers::pi / 2;
-    }
-  };
-
-  class placement_t {
-    int width, height, placement_id = 0;
-    std::vector<piece_t> pieces;
-    std::vector<std::vector<int>> grid;
-    int placements = 0;
-    std::mt19937 rng{std::random_device{}()};
-
-    bool can_place(const_ref_shape_t shape, int x, int y) {
-      for (auto [dx, dy] : shape) {
-        int nx = x + dx, ny = y + dy;
-        if (nx < 0 || nx >= width || ny < 0 || ny >= height || grid[ny][nx] != -1) { 
-          return false; 
-        }
-      }
-      return true;
-    }
+void AMapGenerator::EnqueueActor(TSubclassOf<AActor> ActorClass, const FVector& Position, int32 Ball)
+{
+	if (!ActorClass) return;
+	
+	FPendingMapElement& element = _spawnQueue.AddDefaulted_GetRef();
+	element.ActorClass = ActorClass;
+	element.Position = Position;
+	element.Ball = Ball;
+}
 
-    bool touches_existing(const_ref_shape_t shape, int x, int y) {
-      if (placements == 0) { return true; }
-
-      for (auto [dx, dy] : shape) {
-        int cx = x + dx, cy = y + dy;
-        shape_t neighbors = {{cx-1,cy}, {cx+1,cy}, {cx,cy-1}, {cx,cy+1}};
-        for (auto [nx, ny] : neighbors) {
-          if (nx >= 0 && nx < width && ny >= 0 && ny < height && grid[ny][nx] != -1) 
-            return true;
-        }
-      }
-      return false;
-    }
+void AMapGenerator::StartSpawnQueue()
+{
+	SortSpawnQueue(_playerStartPosition);
+	_spawnQueueTotal = _spawnQueue.Num();
+	
+	UE_LOG(LogNinetyNinePinkBalls, Log, TEXT("Spawning %d map elements"), _spawnQueueTotal);
+	SetActorTickEnabled(true);
+}
 
-    void place(int piece_idx, const_ref_shape_t shape, int x, int y) {
-      for (auto [dx, dy] : shape) {
-        grid[y + dy][x + dx] = placement_id;
-      }
-      placement_id++;
-      placements++;
-      pieces[piece_idx].used_count++;
-    }
+void AMapGenerator::SortSpawnQueue(const FVector& Center)
+{
+	for (FPendingMapElement& element : _spawnQueue)
+	{
+		// Floor rectangles and chunks go by their closest point, the one under the player comes first
+		element.DistanceSquared = element.Extent.IsZero()
+			? FVector::DistSquared2D(element.Position, Center)
+			: FBox::BuildAABB(element.Position, element.Extent).ComputeSquaredDistanceToPoint(FVector(Center.X, Center.Y, element.Position.Z));
+	}
+	_spawnQueue.Sort([](const FPendingMapElement& A, const FPendingMapElement& B)
+	{
+		return A.DistanceSquared > B.DistanceSquared;
+	});
+}
 
-    struct collider_gen_t {
-      int width, height;
-      double cell_size;
-
-      struct segment_t {
-        int x, y;
-        bool is_horizontal;
-        bool is_door = false;
-        
-        bool operator==(const segment_t& oth) const {
-          return x == oth.x && y == oth.y && is_horizontal == oth.is_horizontal;
-        }
-
-        bool operator<(const segment_t& oth) const {
-          if (is_horizontal != oth.is_horizontal) 
-            return is_horizontal < oth.is_horizontal;
-          if (is_horizontal) {
-            if (y != oth.y) return y < oth.y;
-            return x < oth.x;
-          } else {
-            if (x != oth.x) return x < oth.x;
-            return y < oth.y;
-          }
-        } 
-      };
-
-      std::vector<segment_t> extract_wall_segments(std::vector<std::vector<int>> grid) {
-        std::set<segment_t> segments;
-        std::vector<std::tuple<int, int, bool>> doors;
-        std::set<std::pair<int, int>> visited{};
-
-        for (int y = 0; y < height; ++y) {
-          for (int x = 0; x < width; ++x) {
-            int current = grid[y][x];
-
-            if (y == 0 || grid[y-1][x] != current) {
-              if (y == 0 || visited.contains({grid[y-1][x], current}) || grid[y-1][x] == -1 || current == -1)
-                segments.insert({x, y, true});
-              else {
-                segments.insert({x, y, true, true});
-                visited.insert({grid[y-1][x], current});
-                visited.insert({current, grid[y-1][x]});
-              }
-            }
-              
-
-            if (y == height - 1 || grid[y+1][x] != current) {
-              if (y == height - 1 || visited.contains({grid[y+1][x], current}) || grid[y+1][x] == -1 || current == -1)
-                segments.insert({x, y + 1, true});
-              else {
-                segments.insert({x, y + 1, true, true});
-                visited.insert({grid[y+1][x], current});
-                visited.insert({current, grid[y+1][x]});
-              }
-            }
-
-            if (x == 0 || grid[y][x-1] != current) {
-              if (x == 0 || visited.contains({grid[y][x-1], current}) || grid[y][x-1] == -1 || current == -1)
-                segments.insert({x, y, false});
-              else {
-                segments.insert({x, y, false, true});
-                visited.insert({grid[y][x-1], current});
-                visited.insert({current, grid[y][x-1]});
-              }
-            }
-
-            if (x == width - 1 || grid[y][x+1] != current) {
-              if (x == width - 1 || visited.contains({grid[y][x+1], current}) || grid[y][x+1] == -1 || current == -1)
-                segments.insert({x + 1, y, false});
-              else {
-                segments.insert({x + 1, y, false, true});
-                visited.insert({grid[y][x+1], current});
-                visited.insert({current,grid[y][x+1]});
-              }
-            }
-          }
-        }
-
-        return std::vector<segment_t>(segments.begin(), segments.end());
-      }
-
-      std::vector<std::shared_ptr<collider_t>> generate_colliders(std::vector<segment_t> segments) {
-        std::vector<std::shared_ptr<collider_t>> colliders;
-
-        if (segments.empty()) return colliders;
-
-        for (const auto& seg : segments) {
-          double length = cell_size;
-          vector_t centroid;
-
-          if (seg.is_horizontal) {
-            centroid = { (seg.x + 0.5) * cell_size, seg.y * cell_size, 0.0 };
-          } else {
-            centroid = { seg.x * cell_size, (seg.y + 0.5) * cell_size, 0.0 };
-          }
-
-          colliders.emplace_back(std::make_shared<collider_t>(
-            centroid, 
-            seg.is_horizontal ? wall_orientation::H : wall_orientation::V, length, 
-            seg.is_door));
-        }
-
-        return colliders;
-      }
-    };
-
-  public:
-    placement_t(int w, int h, std::vector<piece_t> p) 
-      : width(w), height(h), pieces(p), grid(h, std::vector<int>(w, -1)) {}
-
-    vector_t retrieve_safe_point(int segment_length) {
-      std::uniform_int_distribution<int> dist_x(0, width - 1);
-      std::uniform_int_distribution<int> dist_y(0, height - 1);
-
-      int rx, ry;
-
-      do {
-        rx = dist_x(rng);
-        ry = dist_y(rng);
-      } while (grid[ry][rx] == -1);
-
-      std::uniform_int_distribution<int> offset(
-      -segment_length * 0.75 / 2, segment_length * 0.75 / 2);
-
-      return vector_t{
-        rx * segment_length + segment_length / 2.0 + offset(rng),
-        ry * segment_length + segment_length / 2.0 + offset(rng),
-        0.0
-      };
-    }
+void AMapGenerator::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+	
+	if (!_chunkStates.IsEmpty())
+	{
+		UpdateStreamedChunks();
+	}
+	
+	if (_mazeStream)
+	{
+		const int32 queued = _spawnQueue.Num();
+		EnqueueStreamedRows();
+		if (_spawnQueue.Num() > queued)
+		{
+			_spawnQueueTotal += _spawnQueue.Num() - queued;
+			SortSpawnQueue(GetStreamingCenter());
+		}
+	}
+	
+	const double deadline = FPlatformTime::Seconds() + SpawnBudgetMs / 1000.0;
+	TMap<UStaticMesh*, TArray<FTransform>> instanceBatches;
+	while (!_spawnQueue.IsEmpty())
+	{
+		const FPendingMapElement element = _spawnQueue.Pop(EAllowShrinking::No);
+		if (element.Streamed)
+		{
+			--_streamedWallsQueued;
+		}
+		if (element.Instanced && element.Extent.IsZero())
+		{
+			TArray<FTransform>& batch = instanceBatches.FindOrAdd(element.Mesh);
+			batch.Emplace(element.Rotation, element.Position, FVector(Scale, Scale * element.LengthScale, 1.f));
+			if (batch.Num() >= INSTANCE_BATCH_SIZE)
+			{
+				AddInstances(element.Mesh, batch);
+				batch.Reset();
+			}
+		}
+		else
+		{
+			SpawnPendingElement(element);
+		}
+		if (FPlatformTime::Seconds() >= deadline) break;
+	}
+	for (const TPair<UStaticMesh*, TArray<FTransform>>& batch : instanceBatches)
+	{
+		if (!batch.Value.IsEmpty())
+		{
+			AddInstances(batch.Key, batch.Value);
+		}
+	}
+	
+	OnMapSpawnProgress.Broadcast(GetSpawnProgress());
+	
+	// Rows the stream hasn't reached yet may be within ReadyRadius too
+	const bool rowsPending = _mazeStream && _mazeStream->current_row() * TileSize <= _playerStartPosition.Y + ReadyRadius;
+	if (!_isMapReady && _chunksBuilding == 0 && !rowsPending && (_spawnQueue.IsEmpty() || _spawnQueue.Last().DistanceSquared > FMath::Square(ReadyRadius)))
+	{
+		SetMapReady();
+	}
+	
+	// Streamed chunks are checked every frame
+	if (_spawnQueue.IsEmpty() && _chunkStates.IsEmpty() && !_mazeStream)
+	{
+		_spawnQueue.Empty();
+		SetActorTickEnabled(false);
+	}
+}
 
-    void solve() {
-      bool placed = true;
-      while (placed) {
-        placed = false;
-
-        std::vector<int> order(pieces.size());
-        for (int i = 0; i < pieces.size(); ++i) { order[i] = i; }
-        std::shuffle(order.begin(), order.end(), rng);
-        
-        for (int p_idx : order) {
-          if (pieces[p_idx].used_count >= pieces[p_idx].max_count) { continue; }
-
-          shape_t positions;
-          for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-              positions.push_back({x, y});
-            }
-          }
-          std::shuffle(positions.begin(), positions.end(), rng);
-
-          auto variants = pieces[p_idx].get_variants();
-          std::shuffle(variants.begin(), variants.end(), rng);
-
-          for (auto [x, y] : positions) {
-            if (placed) break;
-            for (const auto& variant : variants) {
-              if (can_place(variant, x, y) && touches_existing(variant, x, y)) {
-                place(p_idx, variant, x, y);
-                placed = true;
-                break;
-              }
-            }
-          }
-          if (placed) break;
-        }
-      }
-    }
+void AMapGenerator::AddInstances(UStaticMesh* Mesh, const TArray<FTransform>& Transforms)
+{
+	TObjectPtr<UHierarchicalInstancedStaticMeshComponent>& component = _instancedMeshes.FindOrAdd(Mesh);
+	if (!component)
+	{
+		component = NewObject<UHierarchicalInstancedStaticMeshComponent>(this);
+		component->SetStaticMesh(Mesh);
+		// Every instance gets its own body so walls still block the players and the balls
+		component->SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+		component->RegisterComponent();
+		_spawnedMapElements.Add(component);
+	}
+	component->AddInstances(Transforms, false);
+}
 
-    std::vector<std::shared_ptr<collider_t>> retrieve_walls(double cell_size) {
-      collider_gen_t collider_gen{width, height, cell_size};
-      auto segments = collider_gen.extract_wall_segments(grid);
-      return collider_gen.generate_colliders(segments);
-    }
+void AMapGenerator::SpawnPendingElement(const FPendingMapElement& Element)
+{
+	if (Element.ActorClass)
+	{
+		AActor* actor = AcquireActor(Element.ActorClass, Element.Position);
+		if (Element.Ball != INDEX_NONE)
+		{
+			_ballActors[Element.Ball] = actor;
+		}
+		else if (Element.ActorClass == _hauntedBallActorClass)
+		{
+			_hauntedBall = actor;
+		}
+		return;
+	}
+	
+	if (Element.Chunk != INDEX_NONE)
+	{
+		UpdateChunkComponent(Element.Chunk);
+		return;
+	}
+	
+	if (!Element.Extent.IsZero())
+	{
+		SpawnFloorRect(Element);
+		return;
+	}
+	
+	UStaticMeshComponent* component = nullptr;
+	while (!component && !_meshPool.IsEmpty())
+	{
+		component = _meshPool.Pop(EAllowShrinking::No);
+	}
+	if (component)
+	{
+		component->SetStaticMesh(Element.Mesh);
+		PlaceMapElement(component, Element.Position, Element.Rotation, Element.LengthScale);
+		component->RegisterComponent();
+	}
+	else
+	{
+		component = NewObject<UStaticMeshComponent>(this);
+		component->SetStaticMesh(Element.Mesh);
+		SpawnMapElement(component, Element.Position, Element.Rotation, Element.LengthScale);
+	}
+	_meshElements.Add(MakeElementKey(Element), component);
+}
 
-    void display() {
-      for (auto& row : grid) {
-        for (int cell : row) {
-          if (cell == -1) {
-            std::cout << ". ";
-          } else {
-            std::cout << (char)('A' + cell % 26) << ' ';
-          }
-        }
-        std::cout << "\n";
-      }
-    }
-  };
+void AMapGenerator::SpawnFloorRect(const FPendingMapElement& Element)
+{
+	UProceduralMeshComponent* component = NewObject<UProceduralMeshComponent>(this);
+	// Collides through the box of the tiles, the quad is never cooked
+	component->bUseComplexAsSimpleCollision = false;
+	component->SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+	component->RegisterComponent();
+	component->SetRelativeLocation(Element.Position);
+	_spawnedMapElements.Add(component);
+	_floorRects.Add(component);
+	
+	// Top of the tiles, wound like the chunk meshes. UVs count tiles from the corner of the
+	// tile (0, 0) so the material repeats per tile instead of stretching over the rectangle.
+	const FBoxSphereBounds bounds = Element.Mesh->GetBounds();
+	const FVector origin = MAP_OFFSET * Scale + (bounds.Origin - bounds.BoxExtent) * FVector(Scale, Scale, 1.f);
+	const FVector& extent = Element.Extent;
+	TArray<FVector> vertices;
+	TArray<FVector2D> uvs;
+	for (const FVector2D corner : {FVector2D(-1, -1), FVector2D(1, -1), FVector2D(1, 1), FVector2D(-1, 1)})
+	{
+		const FVector vertex(corner.X * extent.X, corner.Y * extent.Y, extent.Z);
+		vertices.Add(vertex);
+		uvs.Emplace((Element.Position.X + vertex.X - origin.X) / TileSize, (Element.Position.Y + vertex.Y - origin.Y) / TileSize);
+	}
+	component->CreateMeshSection(0, vertices, {0, 1, 2, 0, 2, 3}, TArray<FVector>{FVector::UpVector, FVector::UpVector, FVector::UpVector, FVector::UpVector},
+		uvs, {}, {}, false);
+	component->SetMaterial(0, Element.Mesh->GetMaterial(0));
+	
+	TArray<FVector> box;
+	for (int32 corner = 0; corner < 8; ++corner)
+	{
+		box.Emplace(corner & 1 ? extent.X : -extent.X, corner & 2 ? extent.Y : -extent.Y, corner & 4 ? extent.Z : -extent.Z);
+	}
+	component->SetCollisionConvexMeshes({box});
+}
 
-  struct map_t {
-    int width, height, cell_size;
-    std::vector<std::shared_ptr<collider_t>> walls;
-    placement_t placer;
+void AMapGenerator::EnqueueChunk(int32 Chunk)
+{
+	const grid_rect_t rect = _chunks->chunk_rect(Chunk);
+	
+	FPendingMapElement& element = _spawnQueue.AddDefaulted_GetRef();
+	element.Chunk = Chunk;
+	element.Extent = FVector(rect.width * TileSize / 2.f, rect.height * TileSize / 2.f, 0.f);
+	element.Position = FVector(_chunks->chunk_origin(Chunk)) + element.Extent;
+}
 
-    map_t(int w, int h, int segment_length, std::vector<piece_t> pieces)
-      : width(w), height(h), cell_size(segment_length), placer(w, h, pieces) {
-      placer.solve();
-      walls = placer.retrieve_walls(cell_size);
-    }
+void AMapGenerator::UpdateChunkComponent(int32 Chunk)
+{
+	// Already uploaded, by RebuildChunks before the chunk's turn in the queue came
+	if (!_chunks->is_built(Chunk)) return;
+	
+	const chunk_mesh_t& mesh = _chunks->mesh(Chunk);
+	
+	TObjectPtr<UProceduralMeshComponent>& component = _chunkComponents[Chunk];
+	if (!component && !_chunkPool.IsEmpty())
+	{
+		component = _chunkPool.Pop(EAllowShrinking::No);
+	}
+	if (!component)
+	{
+		component = NewObject<UProceduralMeshComponent>(this);
+		// Collides through its boxes, the render mesh is never cooked
+		component->bUseComplexAsSimpleCollision = false;
+		component->SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+		component->RegisterComponent();
+		_spawnedMapElements.Add(component);
+	}
+	component->SetRelativeLocation(_chunks->chunk_origin(Chunk));
+	
+	TArray<FVector2D> uvs;
+	uvs.Reserve(static_cast<int32>(mesh.uvs.size()));
+	for (const chunk_uv_t& uv : mesh.uvs)
+	{
+		uvs.Emplace(uv.u, uv.v);
+	}
+	component->CreateMeshSection(0,
+		TArray<FVector>(mesh.vertices.data(), static_cast<int32>(mesh.vertices.size())),
+		TArray<int32>(mesh.triangles.data(), static_cast<int32>(mesh.triangles.size())),
+		TArray<FVector>(mesh.normals.data(), static_cast<int32>(mesh.normals.size())),
+		uvs, {}, {}, false);
+	component->SetMaterial(0, ChunkMaterial);
+	
+	// One body per chunk, every box is a convex element of it
+	TArray<TArray<FVector>> convexes;
+	convexes.Reserve(static_cast<int32>(mesh.boxes.size()));
+	for (const chunk_box_t& box : mesh.boxes)
+	{
+		TArray<FVector>& corners = convexes.AddDefaulted_GetRef();
+		for (int32 corner = 0; corner < 8; ++corner)
+		{
+			corners.Emplace(
+				box.center.X + (corner & 1 ? box.extent.X : -box.extent.X),
+				box.center.Y + (corner & 2 ? box.extent.Y : -box.extent.Y),
+				box.center.Z + (corner & 4 ? box.extent.Z : -box.extent.Z));
+		}
+	}
+	component->SetCollisionConvexMeshes(convexes);
+	
+	// The component keeps its own copy
+	_chunks->release(Chunk);
+}
 
-    vector_t retrieve_safe_point() { return placer.retrieve_safe_point(cell_size); }
-    std::vector<std::shared_ptr<collider_t>>& get_walls() { return walls; }
-
-    [[nodiscard]] std::string latex() const {
-      std::ostringstream oss;
-      oss << std::fixed << std::setprecision(2);
-
-      oss << "\\documentclass[margin=5pt]{standalone}\n"
-          << "\\usepackage{tikz}\n"
-          << "\\begin{document}\n"
-          << "\\begin{tikzpicture}[scale=0.5]\n";
-      for (const auto& wall : walls) {
-        const auto& c = wall->centroid;
-        double half = wall->length / 2.0;
-
-        std::string color = wall->is_door ? "red" : "black";
-
-        if (wall->orientation == wall_orientation::H) {
-          oss << "\\draw[" << color << "] (" << c.X - half << "," << c.Y << ") -- ("
-              << c.X + half << "," << c.Y << ");\n";
-        } else {
-          oss << "\\draw[" << color << "] (" << c.X << "," << c.Y - half << ") -- ("
-              << c.X << "," << c.Y + half << ");\n";
-        }
-      }
-      oss << "\\end{tikzpicture}\n"
-          << "\\end{document}\n";
-
-      return oss.str();
-    }
-  };
-  
-  std::vector<piece_t> pieces = {
-        { 
-          { 
-            {0,5},
-            {0,4},
-            {0,3},
-            {0,2},
-            {0,1}, {1,1}, {2,1}, {3,1}, {4,1}, {5,1},
-            {0,0}, {1,0}, {2,0}, {3,0}, {4,0}, {5,0},
-          },1, 10 
-        },
-        {
-          {
-            {0,5}, {1,5},               {4,5}, {5,5}, 
-            {0,4}, {1,4},               {4,4}, {5,4}, 
-            {0,3}, {1,3}, {2,3}, {3,3}, {4,3}, {5,3},
-            {0,2}, {1,2}, {2,2}, {3,2}, {4,2}, {5,2},
-            {0,1}, {1,1},               {4,1}, {5,1}, 
-            {0,0}, {1,0},               {4,0}, {5,0}, 
-          }, 2, 10
-        },
-        {
-            {
-              {2,3}, {3,3}, {4,3}, {5,3},
-              {2,2}, {3,2}, {4,2}, {5,2},
-    {0,1}, {1,1}, {2,1}, {3,1},
-    {0,0}, {1,0}, {2,0}, {3,0},
-    }, 3, 10
-    },
-    {
-      {
-        {0,2}, {1,2}, {2,2},
-        {0,1}, {1,1}, {2,1},
-        {0,0}, {1,0}, {2,0}
-      }, 1, 4
-    },
-    {
-        {
-          {0,2},        {2,2},
-          {0,1}, {1,1}, {2,1},
-          {0,0},        {2,0}
-        }, 2, 10
-      },
-      {
-        {
-          {0, 0}
-        }, 3, 10 
-      },
-      {
-        {
-          {0,0}, {1,0}, {2,0}
-        }, 4, 10
-      },
-      {
-        {
-          {0,2},
-          {0,1},
-          {0,0}, {1,0}, {2,0}
-        }, 5, 10
-      }
-  };
-};
+void AMapGenerator::RebuildChunks(const FIntRect& Cells)
+{
+	if (!_chunks) return;
+	
+	std::vector<int> chunks = _chunks->chunks_touching({Cells.Min.X, Cells.Min.Y, Cells.Width(), Cells.Height()});
+	// Streamed chunks that aren't loaded are built from the current grid when they load, the
+	// ones building started from an older snapshot and are built again
+	std::erase_if(chunks, [this](int Chunk)
+	{
+		if (!_chunkStates.IsValidIndex(Chunk)) return false;
+		if (_chunkStates[Chunk] == EChunkState::Building)
+		{
+			_staleChunks.Add(Chunk);
+		}
+		return _chunkStates[Chunk] != EChunkState::Loaded;
+	});
+	ParallelFor(static_cast<int32>(chunks.size()), [this, &chunks](int32 Index)
+	{
+		_chunks->build(chunks[Index]);
+	});
+	for (int chunk : chunks)
+	{
+		UpdateChunkComponent(chunk);
+	}
+}
 
-namespace
+bool AMapGenerator::RegenerateRegion(const FIntRect& Cells, int32 RegionSeed)
 {
-   const FVector MAP_OFFSET = {200.f, 200.f, 0.f};
+	if (!_maze)
+	{
+		UE_LOG(LogNinetyNinePinkBalls, Warning, TEXT("RegenerateRegion: only maze maps can be regenerated in place, once generated"));
+		return false;
+	}
+	if (!_chunks && (MergeCollinearWalls || UseInstancedWalls))
+	{
+		UE_LOG(LogNinetyNinePinkBalls, Warning, TEXT("RegenerateRegion: merged or instanced walls can't be changed one by one"));
+		return false;
+	}
+	
+	const std::vector<wall_change_t> changes = _maze->regenerate_region({Cells.Min.X, Cells.Min.Y, Cells.Width(), Cells.Height()}, static_cast<uint32>(RegionSeed));
+	if (changes.empty()) return true;
+	
+	if (_chunks)
+	{
+		// The opened border wall and the wall ends around the region change too
+		FIntRect changed(Cells.Min - FIntPoint(1, 1), Cells.Max + FIntPoint(1, 1));
+		changed.Clip(FIntRect(0, 0, _maze->get_grid().get_width(), _maze->get_grid().get_height()));
+		_maze->copy_emitted(_chunks->get_grid(), {changed.Min.X, changed.Min.Y, changed.Width(), changed.Height()});
+		RebuildChunks(changed);
+		return true;
+	}
+	
+	for (const wall_change_t& change : changes)
+	{
+		if (change.added)
+		{
+			SpawnWall(change.wall);
+		}
+		else
+		{
+			RemoveWall(change.wall);
+		}
+	}
+	if (!_spawnQueue.IsEmpty())
+	{
+		_spawnQueueTotal = FMath::Max(_spawnQueueTotal, _spawnQueue.Num());
+		SortSpawnQueue(GetStreamingCenter());
+		SetActorTickEnabled(true);
+	}
+	return true;
+}
 
+FVector AMapGenerator::GetStreamingCenter() const
+{
+	if (const APawn* pawn = UGameplayStatics::GetPlayerPawn(this, 0))
+	{
+		return pawn->GetActorLocation();
+	}
+	return _playerStartPosition;
 }
 
-bool AMapGenerator::IsMapReady() const
+double AMapGenerator::GetChunkDistanceSquared(int32 Chunk, const FVector& Center) const
 {
-	return _isMapReady;
+	const grid_rect_t rect = _chunks->chunk_rect(Chunk);
+	const FVector min = _chunks->chunk_origin(Chunk);
+	const FVector max = min + FVector(rect.width * TileSize, rect.height * TileSize, 0.f);
+	return FBox(min, max).ComputeSquaredDistanceToPoint(FVector(Center.X, Center.Y, 0.f));
 }
 
-FVector AMapGenerator::GetPlayerStartPosition() const
+int32 AMapGenerator::GetChunkAt(const FVector& Position) const
 {
-	return _playerStartPosition + FVector::UpVector * 200.f;
+	const double chunkLength = _chunks->get_config().chunk_size * TileSize;
+	const int32 column = FMath::Clamp(FMath::FloorToInt32(Position.X / chunkLength), 0, _chunks->chunk_columns() - 1);
+	const int32 row = FMath::Clamp(FMath::FloorToInt32(Position.Y / chunkLength), 0, _chunks->chunk_rows() - 1);
+	return row * _chunks->chunk_columns() + column;
 }
 
-void AMapGenerator::BeginPlay()
+void AMapGenerator::RebucketStreamedBalls()
 {
-  Super::BeginPlay();
-  GenerateMap();
+	for (int32 chunk = 0; chunk < _chunkBalls.Num(); ++chunk)
+	{
+		TArray<int32>& balls = _chunkBalls[chunk];
+		for (int32 index = balls.Num() - 1; index >= 0; --index)
+		{
+			const AActor* actor = _ballActors[balls[index]].Get();
+			if (!actor) continue;
+			
+			const int32 current = GetChunkAt(actor->GetActorLocation());
+			if (current == chunk) continue;
+			_chunkBalls[current].Add(balls[index]);
+			balls.RemoveAtSwap(index);
+		}
+	}
 }
 
-map_config_t AMapGenerator::GetConfig() const
+bool AMapGenerator::IsHeld(const AActor* Actor) const
 {
-  map_config_t config;
-  config.height = MapHeight;
-  config.width = MapWidth;
-  config.segment_length = TileSize;
-  config.threshold = Threshold;
-  return config;
+	for (FConstPlayerControllerIterator it = GetWorld()->GetPlayerControllerIterator(); it; ++it)
+	{
+		const APawn* pawn = it->IsValid() ? (*it)->GetPawn() : nullptr;
+		const UPhysicsHandleComponent* handle = pawn ? pawn->FindComponentByClass<UPhysicsHandleComponent>() : nullptr;
+		const UPrimitiveComponent* grabbed = handle ? handle->GetGrabbedComponent() : nullptr;
+		if (grabbed && grabbed->GetOwner() == Actor) return true;
+	}
+	return false;
 }
 
-std::vector<std::shared_ptr<collider_t>> AMapGenerator::CalculatePositionsWithMap()
+void AMapGenerator::UpdateStreamedChunks()
 {
-	map_config_t config = GetConfig();
+	const FVector center = GetStreamingCenter();
 	
-	map_t map {config};
-	auto walls = map.get_walls();
-  _playerStartPosition = map.retrieve_safe_point();
-
-  _ghostPosition = map.retrieve_safe_point();
-  int32 tries = 0;
-  while (FVector::PointsAreNear(_ghostPosition, _playerStartPosition, 5000.f) && tries < 5000)
-  {
-    _ghostPosition = map.retrieve_safe_point();
-    ++tries;
-  }
+	bool rebucketed = false;
+	for (auto it = _activeChunks.CreateIterator(); it; ++it)
+	{
+		// Chunks still building are unloaded once they are done
+		if (_chunkStates[*it] == EChunkState::Loaded && GetChunkDistanceSquared(*it, center) > FMath::Square(StreamUnloadRadius))
+		{
+			if (!rebucketed)
+			{
+				RebucketStreamedBalls();
+				rebucketed = true;
+			}
+			UnloadChunk(*it);
+			it.RemoveCurrent();
+		}
+	}
 	
-	return walls;
+	// Only the chunks under the load radius are looked at, not the whole map
+	const double chunkLength = _chunks->get_config().chunk_size * TileSize;
+	const int32 minColumn = FMath::Max(FMath::FloorToInt32((center.X - StreamLoadRadius) / chunkLength), 0);
+	const int32 maxColumn = FMath::Min(FMath::FloorToInt32((center.X + StreamLoadRadius) / chunkLength), _chunks->chunk_columns() - 1);
+	const int32 minRow = FMath::Max(FMath::FloorToInt32((center.Y - StreamLoadRadius) / chunkLength), 0);
+	const int32 maxRow = FMath::Min(FMath::FloorToInt32((center.Y + StreamLoadRadius) / chunkLength), _chunks->chunk_rows() - 1);
+	for (int32 row = minRow; row <= maxRow; ++row)
+	{
+		for (int32 column = minColumn; column <= maxColumn; ++column)
+		{
+			const int32 chunk = row * _chunks->chunk_columns() + column;
+			if (_chunkStates[chunk] == EChunkState::Unloaded && GetChunkDistanceSquared(chunk, center) <= FMath::Square(StreamLoadRadius))
+			{
+				LoadChunk(chunk);
+			}
+		}
+	}
 }
 
-std::vector<std::shared_ptr<pavage::collider_t>> AMapGenerator::CalculatePositionsWithPavage()
+void AMapGenerator::LoadChunk(int32 Chunk)
 {
-  map_config_t config = GetConfig();
-
-  pavage::map_t map {config.width, config.height, config.segment_length, pavage::pieces};
-  _playerStartPosition = map.retrieve_safe_point();
+	_chunkStates[Chunk] = EChunkState::Building;
+	_activeChunks.Add(Chunk);
+	++_chunksBuilding;
+	BuildChunkAsync(Chunk);
+}
 
-  _ghostPosition = map.retrieve_safe_point();
-  int32 tries = 0;
-  while (FVector::PointsAreNear(_ghostPosition, _playerStartPosition, 5000.f) && tries < 5000)
-  {
-    _ghostPosition = map.retrieve_safe_point();
-    ++tries;
-  }
-  
-  _ghostPosition += MAP_OFFSET.X * FVector::UpVector;
-  
-  return map.get_walls();
+void AMapGenerator::BuildChunkAsync(int32 Chunk)
+{
+	// A chunk is never built twice at once, it can't unload while building. RegenerateRegion
+	// copies the grid before changing it while the snapshot is held.
+	TWeakObjectPtr<AMapGenerator> weakThis(this);
+	Async(EAsyncExecution::ThreadPool, [chunks = _chunks, grid = _chunks->snapshot(), Chunk, weakThis, generation = _mapGeneration]()
+	{
+		chunks->build(Chunk, *grid);
+		AsyncTask(ENamedThreads::GameThread, [weakThis, Chunk, generation]()
+		{
+			if (AMapGenerator* generator = weakThis.Get())
+			{
+				generator->OnChunkBuilt(Chunk, generation);
+			}
+		});
+	});
 }
 
-void AMapGenerator::SetMapReady()
+void AMapGenerator::OnChunkBuilt(int32 Chunk, int32 Generation)
 {
-	_isMapReady = true;
-	OnMapReady.Broadcast();
+	// Built for a map that has been regenerated since
+	if (Generation != _mapGeneration) return;
+	
+	if (_staleChunks.Remove(Chunk) > 0)
+	{
+		BuildChunkAsync(Chunk);
+		return;
+	}
+	
+	--_chunksBuilding;
+	_chunkStates[Chunk] = EChunkState::Loaded;
+	
+	EnqueueChunk(Chunk);
+	for (int32 ball : _chunkBalls[Chunk])
+	{
+		// Still spawned, carried here from an unloaded chunk, or picked up
+		if (!_ballActors[ball].IsExplicitlyNull()) continue;
+		
+		FPendingMapElement& element = _spawnQueue.AddDefaulted_GetRef();
+		element.ActorClass = _ballActorClass;
+		element.Position = FVector(_ballPositions[ball].X, _ballPositions[ball].Y, 150.f);
+		element.Chunk = Chunk;
+		element.Ball = ball;
+	}
+	SortSpawnQueue(GetStreamingCenter());
 }
 
-void AMapGenerator::GenerateMap()
+void AMapGenerator::UnloadChunk(int32 Chunk)
 {
-	SpawnFloor();
-  if (UsesPavage)
-  {
-    SpawnWallsAndDoors();
-  }
-  else
-  {
-    SpawnWalls();
-  }
-	PlaceObstacle();
-  SpawnBalls();
+	_chunkStates[Chunk] = EChunkState::Unloaded;
+	_spawnQueue.RemoveAll([Chunk](const FPendingMapElement& Element)
+	{
+		return Element.Chunk == Chunk;
+	});
+	
+	if (UProceduralMeshComponent* component = _chunkComponents[Chunk])
+	{
+		component->ClearAllMeshSections();
+		component->ClearCollisionConvexMeshes();
+		_chunkPool.Push(component);
+		_chunkComponents[Chunk] = nullptr;
+	}
+	_chunks->release(Chunk);
 	
-	SetMapReady();
+	// The balls were moved to the chunk they are on, one in a player's hands stays spawned
+	for (int32 ball : _chunkBalls[Chunk])
+	{
+		AActor* actor = _ballActors[ball].Get();
+		if (!actor || IsHeld(actor)) continue;
+		
+		// Spawned again where it was left when the chunk loads
+		const FVector location = actor->GetActorLocation();
+		_ballPositions[ball] = FVector(location.X, location.Y, 0.f);
+		actor->Destroy();
+		// Reset so the ball doesn't look picked up
+		_ballActors[ball].Reset();
+	}
 }
 
-void AMapGenerator::SpawnMapElement(USceneComponent* ComponentToSpawn, const FVector& Position, const FRotator& Rotation)
+void AMapGenerator::SpawnMapElement(USceneComponent* ComponentToSpawn, const FVector& Position, const FRotator& Rotation, float LengthScale)
 {
-	ComponentToSpawn->SetRelativeLocation(Position);
-	ComponentToSpawn->SetRelativeRotation(Rotation);
-  ComponentToSpawn->SetRelativeScale3D(FVector(Scale, Scale, 1.f));
+	PlaceMapElement(ComponentToSpawn, Position, Rotation, LengthScale);
 			
 	ComponentToSpawn->RegisterComponent();
 	_spawnedMapElements.Add(ComponentToSpawn);
 }
 
+void AMapGenerator::PlaceMapElement(USceneComponent* Component, const FVector& Position, const FRotator& Rotation, float LengthScale) const
+{
+	// Only called on unregistered components, static ones can't move once registered
+	Component->SetRelativeLocation(Position);
+	Component->SetRelativeRotation(Rotation);
+  Component->SetRelativeScale3D(FVector(Scale, Scale * LengthScale, 1.f));
+}
+
 void AMapGenerator::PlaceObstacle()
 {
     // TODO: Implement
 }
 
-void AMapGenerator::SpawnFloor()
+void AMapGenerator::SpawnFloor(const std::vector<floor_rect_t>& Floor)
 {
+	if (MergeFloorTiles)
+	{
+		for (const floor_rect_t& rect : Floor)
+		{
+			EnqueueFloorRect(FloorMeshes[0], rect);
+		}
+		return;
+	}
+	
 	for (int i = 0; i< MapWidth; i++)
 	{
 		for (int j = 0; j< MapHeight; j++)
 		{
-			UStaticMeshComponent* spawnedFloorTile = NewObject<UStaticMeshComponent>(this);
-			spawnedFloorTile->SetStaticMesh(FloorMeshes[0]);
 			const auto position = FVector(TileSize * i, TileSize * j, 0.f) + MAP_OFFSET * Scale;
-			SpawnMapElement(spawnedFloorTile, position);
+			EnqueueMapElement(FloorMeshes[0], position).Floor = true;
 		}
 	}
 }
 
-void AMapGenerator::SpawnWalls()
+void AMapGenerator::SpawnWalls(const collider_buffer_t& Walls)
 {
-	std::vector<std::shared_ptr<collider_t>> wallPositions = CalculatePositionsWithMap();
-	
-	for (const auto& wallPosition : wallPositions)
+	for (size_t wall = 0; wall < Walls.size(); ++wall)
 	{
-		UStaticMeshComponent* wallToSpawn = NewObject<UStaticMeshComponent>(this);
-	
-		wallToSpawn->SetStaticMesh(WallMeshes[0]);
+		UStaticMesh* mesh = PickMesh(Walls.is_door(wall) ? DoorMeshes : WallMeshes);
 		
-		FRotator rotation = wallPosition->orientation == wall_orientation::V
-			? FRotator{} 
+		FRotator rotation = Walls.is_vertical(wall)
+			? FRotator{}
 			: FRotator(0, 90.f, 0.f);
 		
-		SpawnMapElement(wallToSpawn, wallPosition->centroid, rotation);
+		EnqueueMapElement(mesh, Walls.centroid(wall), rotation, Walls.length(wall) / TileSize, UseInstancedWalls);
 	}
 }
 
-void AMapGenerator::SpawnWallsAndDoors()
+void AMapGenerator::SpawnStreamedWalls()
 {
-  std::vector<std::shared_ptr<pavage::collider_t>> wallPositions = CalculatePositionsWithPavage();
+	_mazeStream = std::make_shared<maze_stream_t>(GetConfig());
+	maze_stream_t& maze = *_mazeStream;
 	
-  for (const auto& wallPosition : wallPositions)
-  {
-    UStaticMeshComponent* wallToSpawn = NewObject<UStaticMeshComponent>(this);
+	// The streamed maze is never held in full so there is no distance field,
+	// the ghost is only kept away in straight line.
+	_playerStartPosition = maze.retrieve_safe_point();
+	_ghostPosition = maze.retrieve_safe_point();
+	int32 tries = 0;
+	while (FVector::PointsAreNear(_ghostPosition, _playerStartPosition, 5000.f) && tries < 5000)
+	{
+		_ghostPosition = maze.retrieve_safe_point();
+		++tries;
+	}
 	
-    UStaticMesh* mesh = wallPosition->is_door ? DoorMeshes[0] :WallMeshes[0];
-    wallToSpawn->SetStaticMesh(mesh);
-		
-    FRotator rotation = wallPosition->orientation == wall_orientation::V
-      ? FRotator{} 
-    : FRotator(0, 90.f, 0.f);
-		
-    SpawnMapElement(wallToSpawn, wallPosition->centroid, rotation);
-  }
+	// Same for the balls, they are only spread uniformly over the map.
+	FRandomStream ballStream(HashCombine(GetTypeHash(_activeSeed), 0xBA11u));
+	_ballPositions.Reset();
+	for (int i = 0; i < _ballCount; ++i)
+	{
+		_ballPositions.Emplace(ballStream.FRandRange(0.f, MapWidth * TileSize), ballStream.FRandRange(0.f, MapHeight * TileSize), 0.f);
+	}
+	
+	// The first rows, Tick pulls the next ones as they spawn
+	_streamedWallsQueued = 0;
+	EnqueueStreamedRows();
+}
+
+void AMapGenerator::EnqueueStreamedRows()
+{
+	const int32 wallsAhead = STREAMED_ROWS_AHEAD * (2 * MapWidth + 1);
+	while (!_mazeStream->done() && _streamedWallsQueued < wallsAhead)
+	{
+		const int32 queued = _spawnQueue.Num();
+		for (const collider_t& wall : _mazeStream->next_row())
+		{
+			SpawnWall(wall);
+		}
+		for (int32 index = queued; index < _spawnQueue.Num(); ++index)
+		{
+			_spawnQueue[index].Streamed = true;
+		}
+		_streamedWallsQueued += _spawnQueue.Num() - queued;
+	}
+	
+	if (_mazeStream->done())
+	{
+		_mazeStream.reset();
+	}
+}
+
+void AMapGenerator::SpawnWall(const collider_t& Wall)
+{
+	FRotator rotation = Wall.orientation == wall_orientation::V
+		? FRotator{} 
+		: FRotator(0, 90.f, 0.f);
+	
+	EnqueueMapElement(PickMesh(WallMeshes), Wall.centroid, rotation, Wall.length / TileSize, UseInstancedWalls);
+}
+
+void AMapGenerator::RemoveWall(const collider_t& Wall)
+{
+	FPendingMapElement element;
+	element.Position = Wall.centroid;
+	element.Rotation = Wall.orientation == wall_orientation::V ? FRotator{} : FRotator(0, 90.f, 0.f);
+	element.LengthScale = Wall.length / TileSize;
+	
+	const FMapElementKey key = MakeElementKey(element);
+	TWeakObjectPtr<UStaticMeshComponent> component;
+	if (_meshElements.RemoveAndCopyValue(key, component) && component.IsValid())
+	{
+		component->UnregisterComponent();
+		_meshPool.Add(component.Get());
+		return;
+	}
+	
+	_spawnQueue.RemoveAll([&key](const FPendingMapElement& Pending)
+	{
+		return Pending.Mesh && Pending.Extent.IsZero() && MakeElementKey(Pending) == key;
+	});
 }
 
 void AMapGenerator::SpawnBalls()
 {
-  for (int i = 0; i < _ballCount; ++i)
+  if (_ballPositions.Num() < _ballCount)
+  {
+    UE_LOG(LogNinetyNinePinkBalls, Warning, TEXT("Only %d of %d balls fit in the map"), _ballPositions.Num(), _ballCount);
+  }
+  
+  // Streamed balls are spawned and destroyed with their chunk
+  if (!_chunkStates.IsEmpty())
+  {
+    _chunkBalls.SetNum(_chunks->chunk_count());
+    _ballActors.SetNum(_ballPositions.Num());
+    for (int32 ball = 0; ball < _ballPositions.Num(); ++ball)
+    {
+      _chunkBalls[GetChunkAt(_ballPositions[ball])].Add(ball);
+    }
+    EnqueueActor(_hauntedBallActorClass, _ghostPosition);
+    return;
+  }
+  
+  _ballActors.SetNum(_ballPositions.Num());
+  for (int32 ball = 0; ball < _ballPositions.Num(); ++ball)
   {
-      float posx = FMath::RandRange(0.f, MapWidth * TileSize);
-      float posy = FMath::RandRange(0.f, MapHeight * TileSize);
-      FVector ballPosition = FVector(posx, posy, 150.f);
-      GetWorld()->SpawnActor(_ballActorClass, &ballPosition);
+      EnqueueActor(_ballActorClass, FVector(_ballPositions[ball].X, _ballPositions[ball].Y, 150.f), ball);
   }
-  GetWorld()->SpawnActor(_hauntedBallActorClass, &_ghostPosition);
+  EnqueueActor(_hauntedBallActorClass, _ghostPosition);
 }
@@ -13,13 +13,19 @@
 // Generated
 #include "MapGenerator.generated.h"
 
-namespace pavage
-{
-	struct collider_t;
-}
-
 struct collider_t;
+class collider_buffer_t;
+struct wall_change_t;
+class map_t;
+class maze_stream_t;
 struct map_config_t;
+struct ball_placement_config_t;
+struct floor_rect_t;
+class map_chunks_t;
+struct FMapLayout;
+class UHierarchicalInstancedStaticMeshComponent;
+class UProceduralMeshComponent;
+class UPavagePieceCatalog;
 
 enum class EWallOrientation
 {
@@ -27,6 +33,54 @@ enum class EWallOrientation
 	Horizontal,
 };
 
+enum class EChunkState : uint8
+{
+	Unloaded,
+	// Mesh being built on a worker
+	Building,
+	Loaded,
+};
+
+UENUM()
+enum class EMazeAlgorithm : uint8
+{
+	Prim,
+	Kruskal,
+	Wilson,
+	Backtracker,
+};
+
+UENUM()
+enum class EPavageSolver : uint8
+{
+	// Scans the whole map for every piece
+	Scan,
+	// Only tries the cells next to the pieces already placed, for large maps
+	Frontier,
+};
+
+/**
+ * Overrides the wall pruning settings for a rectangle of the maze, in cells.
+ */
+USTRUCT()
+struct FMazePruneRegion
+{
+	GENERATED_BODY()
+	
+	// Top left cell of the region, X is the column and Y the row
+	UPROPERTY(EditAnywhere)
+	FIntPoint Min = FIntPoint::ZeroValue;
+	
+	UPROPERTY(EditAnywhere)
+	FIntPoint Size = FIntPoint(10, 10);
+	
+	UPROPERTY(EditAnywhere, meta=(ClampMin="1"))
+	int32 Window = 4;
+	
+	UPROPERTY(EditAnywhere)
+	int32 Threshold = 30;
+};
+
 
 
 // struct FWallPosition
@@ -36,6 +90,50 @@ enum class EWallOrientation
 // 	EWallOrientation Orientation {};
 // };
 
+// A floor tile, wall, door or ball waiting in the spawn queue. Mesh is set for the
+// map elements and ActorClass for the balls. Merged floor rectangles also set Extent,
+// chunks set Chunk and Extent. Streamed balls set Ball and the Chunk they are in.
+struct FPendingMapElement
+{
+	UStaticMesh* Mesh = nullptr;
+	TSubclassOf<AActor> ActorClass;
+	FVector Position = FVector::Zero();
+	FRotator Rotation = FRotator::ZeroRotator;
+	float LengthScale = 1.f;
+	// Added as an instance of the mesh instead of its own component
+	bool Instanced = false;
+	// A floor tile, never matched with a wall at the same spot
+	bool Floor = false;
+	// Half size of a floor rectangle or a chunk centred on Position. Floor rectangles are
+	// spawned as one quad with the material of Mesh and one collision box.
+	FVector Extent = FVector::Zero();
+	int32 Chunk = INDEX_NONE;
+	int32 Ball = INDEX_NONE;
+	// A wall of the streamed maze, counted in _streamedWallsQueued
+	bool Streamed = false;
+	double DistanceSquared = 0.;
+};
+
+// Identifies a spawned mesh element, a regenerated map keeps the components of the
+// elements found in both layouts. The mesh isn't part of it, it's drawn per seed and set
+// again on the kept component.
+struct FMapElementKey
+{
+	FIntVector Position = FIntVector::ZeroValue;
+	int32 Yaw = 0;
+	// In thousandths
+	int32 LengthScale = 0;
+	bool Floor = false;
+	
+	bool operator==(const FMapElementKey& Other) const = default;
+	
+	friend uint32 GetTypeHash(const FMapElementKey& Key)
+	{
+		uint32 hash = HashCombine(GetTypeHash(Key.Position), GetTypeHash(Key.Floor));
+		return HashCombine(hash, HashCombine(GetTypeHash(Key.Yaw), GetTypeHash(Key.LengthScale)));
+	}
+};
+
 /**
  * Handles the spawning of floor tiles and walls
  */
@@ -45,31 +143,106 @@ class NINETYNINEPINKBALLS_API  AMapGenerator : public AActor
 	GENERATED_BODY()
 	
 public:
+	AMapGenerator();
+	
 	DECLARE_EVENT(AMapGenerator, MapReadyEvent);
 	MapReadyEvent OnMapReady;
 	bool IsMapReady() const;
 	
+	// Share of the map elements spawned so far, broadcast every frame the queue is worked on
+	DECLARE_EVENT_OneParam(AMapGenerator, MapSpawnProgressEvent, float);
+	MapSpawnProgressEvent OnMapSpawnProgress;
+	float GetSpawnProgress() const;
+	
 	FVector GetPlayerStartPosition() const;
 	
+	// Replaces the map with the one of NewSeed without reloading the level. Components of
+	// walls, doors and floor tiles found in both maps stay as they are, the others are
+	// pooled and moved to the new elements, ball actors are moved too. OnMapReady is
+	// broadcast again once the new map is ready.
+	void RegenerateMap(int32 NewSeed);
+	
+	// Rebuilds the chunk meshes over Cells (X is the column, Y the row) after their walls
+	// changed, the other chunks are left as is. Only used with BuildChunkMeshes.
+	void RebuildChunks(const FIntRect& Cells);
+	
+	// Carves a new maze inside Cells (X is the column, Y the row) while the map is played,
+	// the rest of the map is left as is and stays connected to it. The same RegionSeed gives
+	// the same walls. Returns false when the map can't be changed in place: pavage maps,
+	// merged or instanced walls without BuildChunkMeshes, or no map spawned yet.
+	bool RegenerateRegion(const FIntRect& Cells, int32 RegionSeed);
+	
+	virtual void Tick(float DeltaSeconds) override;
+	
 protected:
 	virtual void BeginPlay() override;
 	
 private:
-	std::vector<std::shared_ptr<collider_t>> CalculatePositionsWithMap();
-	std::vector<std::shared_ptr<pavage::collider_t>> CalculatePositionsWithPavage();
 	map_config_t GetConfig() const;
+	int32 GetGhostMaxPathDistance() const;
+	ball_placement_config_t GetBallConfig() const;
 
 	void SetMapReady();
-	void SpawnWallsAndDoors();
-	void GenerateMap();
-	void SpawnMapElement(USceneComponent* ComponentToSpawn, const FVector& Position, const FRotator& Rotation = {});
+	// Computes the layout on a background task, OnLayoutReady spawns it on the game thread
+	void GenerateMap(int32 MapSeed);
+	// Stops spawning and streaming the current map, it stays visible and colliding until the next
+	// layout is ready
+	void RetireSpawnedMap();
+	// Clears the retired map right before the next one is queued, its elements wait in
+	// _retiredElements and the pools
+	void ClearRetiredMap();
+	// Drops the queued elements that are already spawned and pools the retired ones left
+	void ReuseRetiredElements();
+	static FMapElementKey MakeElementKey(const FPendingMapElement& Element);
+	AActor* AcquireActor(TSubclassOf<AActor> ActorClass, const FVector& Position);
+	void OnLayoutReady(const FMapLayout& Layout);
+	// LengthScale stretches the element along its local Y axis, the axis walls run along
+	void SpawnMapElement(USceneComponent* ComponentToSpawn, const FVector& Position, const FRotator& Rotation = {}, float LengthScale = 1.f);
+	void PlaceMapElement(USceneComponent* Component, const FVector& Position, const FRotator& Rotation, float LengthScale) const;
+	
+	// Map elements are queued then spawned closest to the player first, a few per frame
+	FPendingMapElement& EnqueueMapElement(UStaticMesh* Mesh, const FVector& Position, const FRotator& Rotation = {}, float LengthScale = 1.f, bool Instanced = false);
+	// Ball is the index of the ball in _ballPositions, the actor is kept in _ballActors
+	void EnqueueActor(TSubclassOf<AActor> ActorClass, const FVector& Position, int32 Ball = INDEX_NONE);
+	void StartSpawnQueue();
+	void SortSpawnQueue(const FVector& Center);
+	void SpawnPendingElement(const FPendingMapElement& Element);
+	void EnqueueFloorRect(UStaticMesh* Mesh, const floor_rect_t& Rect);
+	void AddInstances(UStaticMesh* Mesh, const TArray<FTransform>& Transforms);
+	void SpawnFloorRect(const FPendingMapElement& Element);
+	void EnqueueChunk(int32 Chunk);
+	// Creates the component of the chunk or replaces its mesh and collision
+	void UpdateChunkComponent(int32 Chunk);
+	
+	// Loads the chunks within StreamLoadRadius of the player and unloads the ones past StreamUnloadRadius
+	void UpdateStreamedChunks();
+	FVector GetStreamingCenter() const;
+	double GetChunkDistanceSquared(int32 Chunk, const FVector& Center) const;
+	int32 GetChunkAt(const FVector& Position) const;
+	// Moves the spawned balls to the chunk they are on now, they roll and get carried around
+	void RebucketStreamedBalls();
+	bool IsHeld(const AActor* Actor) const;
+	void LoadChunk(int32 Chunk);
+	// Builds the chunk on a worker from a snapshot of the grid
+	void BuildChunkAsync(int32 Chunk);
+	void OnChunkBuilt(int32 Chunk, int32 Generation);
+	void UnloadChunk(int32 Chunk);
+	// Random entry of Meshes drawn from the seeded mesh stream
+	UStaticMesh* PickMesh(const TArray<UStaticMesh*>& Meshes);
 
 	void PlaceObstacle();
 	
-	void SpawnFloor();
+	// One element per tile, or per floor rectangle when MergeFloorTiles is set
+	void SpawnFloor(const std::vector<floor_rect_t>& Floor);
 	
-	//template<class T>
-	void SpawnWalls();
+	// Doors only come from pavage maps, they use DoorMeshes
+	void SpawnWalls(const collider_buffer_t& Walls);
+	void SpawnStreamedWalls();
+	// Pulls rows from _mazeStream until STREAMED_ROWS_AHEAD rows of walls are queued
+	void EnqueueStreamedRows();
+	void SpawnWall(const collider_t& Wall);
+	// Removes the wall component spawned for Wall, or its queued element
+	void RemoveWall(const collider_t& Wall);
 	
 	
 	void SpawnBalls();
@@ -86,9 +259,81 @@ private:
 	UPROPERTY(EditDefaultsOnly, Category="Map Elements")
 	TArray<UStaticMesh*> DoorMeshes;
 	
+	// Spawns walls and doors as instances, one hierarchical instanced component per mesh
+	UPROPERTY(EditDefaultsOnly, Category="Map Elements")
+	bool UseInstancedWalls = false;
+	
+	// Covers the floor with the fewest rectangles of tiles, each one a single generated quad
+	// with one collision box. The quad has the material of the first floor mesh and one UV unit
+	// per tile, so the material repeats per tile. Empty pavage cells get no floor.
+	UPROPERTY(EditDefaultsOnly, Category="Map Elements")
+	bool MergeFloorTiles = false;
+	
+	// Walls and doors only, the merged floor has its own components in _floorRects
+	UPROPERTY()
+	TMap<TObjectPtr<UStaticMesh>, TObjectPtr<UHierarchicalInstancedStaticMeshComponent>> _instancedMeshes;
+	
+	// Builds walls, doors and floor as generated meshes straight from the layout, one mesh
+	// and one collision body per chunk of ChunkSize x ChunkSize cells. The wall, door and
+	// floor meshes aren't used then. Ignored with StreamMazeRows.
+	UPROPERTY(EditDefaultsOnly, Category="Map Elements")
+	bool BuildChunkMeshes = false;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes", ClampMin="1"))
+	int32 ChunkSize = 32;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes", ClampMin="0"))
+	float WallHeight = 300.f;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes", ClampMin="0"))
+	float WallThickness = 20.f;
+	
+	// Height of the door openings between pavage rooms
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes", ClampMin="0"))
+	float DoorHeight = 220.f;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes"))
+	TObjectPtr<UMaterialInterface> ChunkMaterial;
+	
+	// Only keeps the chunks around the player, with their balls. Chunks are built on a worker
+	// and spawned once within StreamLoadRadius of the player, then pooled once farther than
+	// StreamUnloadRadius. Memory and frame time follow the radius instead of the map size.
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="BuildChunkMeshes"))
+	bool StreamChunks = false;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="StreamChunks", ClampMin="0"))
+	float StreamLoadRadius = 8000.f;
+	
+	// Kept above StreamLoadRadius so the chunks on the edge don't load and unload every frame
+	UPROPERTY(EditDefaultsOnly, Category="Chunk Settings", meta=(EditCondition="StreamChunks", ClampMin="0"))
+	float StreamUnloadRadius = 10000.f;
+	
+	UPROPERTY()
+	TArray<TObjectPtr<UProceduralMeshComponent>> _chunkComponents;
+	
+	// Components of the unloaded chunks, emptied and waiting to be reused
+	UPROPERTY()
+	TArray<TObjectPtr<UProceduralMeshComponent>> _chunkPool;
+	
+	// Unregistered components waiting for a new element after RegenerateMap
+	UPROPERTY()
+	TArray<TObjectPtr<UStaticMeshComponent>> _meshPool;
+	
+	// Hidden balls waiting to be moved to the next map
+	UPROPERTY()
+	TArray<TObjectPtr<AActor>> _actorPool;
+	
 	UPROPERTY(EditDefaultsOnly, Category="Map Options")
 	bool UsesPavage = true;
 	
+	// Picks a new seed every time the map is generated, the seed used is logged so the layout can be reproduced
+	UPROPERTY(EditDefaultsOnly, Category="Map Options")
+	bool UseRandomSeed = true;
+	
+	// Same seed and options give the same map, walls and balls included, on every platform
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="!UseRandomSeed"))
+	int32 Seed = 0;
+	
 	UPROPERTY(EditDefaultsOnly, Category="Map Options")
 	int32 MapWidth;
 	
@@ -98,12 +343,88 @@ private:
 	UPROPERTY(EditDefaultsOnly, Category="Map Options")
 	int32 Threshold = 30;
 	
+	// Size of the square window whose wall count is compared to Threshold
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(ClampMin="0"))
+	int32 PruneWindow = 4;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Map Options")
+	TArray<FMazePruneRegion> PruneRegions;
+	
+	// Pieces the pavage tiles the map with, the built-in ones when empty
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage"))
+	TObjectPtr<UPavagePieceCatalog> PieceCatalog;
+	
+	// Scan gives the maps pavage always gave for a seed, Frontier is much faster on large maps
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage"))
+	EPavageSolver PavageSolver = EPavageSolver::Scan;
+	
+	// Tiles the map this many times with independent seeds and keeps the tiling covering the most
+	// cells, 1 solves it once. The seed still gives the same map when PavageSolveBudgetMs is 0.
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage", ClampMin="1"))
+	int32 PavagePortfolioSolves = 1;
+	
+	// Worker threads of the portfolio, 0 uses one per core
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage && PavagePortfolioSolves > 1", ClampMin="0"))
+	int32 PavagePortfolioThreads = 0;
+	
+	// Time given to the portfolio, the solves still running then stop and the best tiling so far is
+	// kept. 0 for no limit.
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage && PavagePortfolioSolves > 1", ClampMin="0"))
+	int32 PavageSolveBudgetMs = 0;
+	
+	// Places the doors of a random spanning tree of the rooms, so every room can be reached, instead
+	// of a door between every pair of adjacent rooms
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage"))
+	bool SpanningTreeDoors = false;
+	
+	// Share of the adjacent rooms left out of the spanning tree that still get a door, 0 for no loops
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="UsesPavage && SpanningTreeDoors", ClampMin="0", ClampMax="1"))
+	float LoopDoorFraction = 0.1f;
+	
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="!UsesPavage"))
+	EMazeAlgorithm MazeAlgorithm = EMazeAlgorithm::Prim;
+	
+	// Generates the maze row by row (Eller's algorithm), the next rows are generated as the
+	// spawn queue drains so only a few are held at a time. MazeAlgorithm and Threshold are ignored.
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="!UsesPavage"))
+	bool StreamMazeRows = false;
+	
+	// Carves and prunes the maze in tiles of about this many cells on worker threads, 0 builds it in one piece.
+	// The maze only depends on the seed and the tile size, not on the number of threads.
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="!UsesPavage && !StreamMazeRows", ClampMin="0"))
+	int32 MazeTileSize = 0;
+	
+	// Worker threads used when MazeTileSize is set, 0 uses one per core
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(EditCondition="MazeTileSize > 0", ClampMin="0"))
+	int32 MazeThreads = 0;
+	
+	// Spawns runs of adjacent collinear walls as a single stretched wall, doors are kept as is
+	UPROPERTY(EditDefaultsOnly, Category="Map Options")
+	bool MergeCollinearWalls = false;
+	
+	// Path distance, in tiles, between the player start and the haunted ball. When no tile is
+	// that far the haunted ball goes to one of the farthest reachable tiles.
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(ClampMin="0"))
+	int32 GhostMinPathDistance = 10;
+	
+	// 0 for no upper bound
+	UPROPERTY(EditDefaultsOnly, Category="Map Options", meta=(ClampMin="0"))
+	int32 GhostMaxPathDistance = 0;
+	
 	UPROPERTY(EditDefaultsOnly, Category="Map Options")
 	float Scale = 1.f;
 	
 	UPROPERTY(EditDefaultsOnly, Category="Tile Settings")
 	float TileSize = 500.f;
 	
+	// Time spent spawning map elements per frame, at least one element is spawned every frame
+	UPROPERTY(EditDefaultsOnly, Category="Spawn Settings", meta=(ClampMin="0.1"))
+	float SpawnBudgetMs = 4.f;
+	
+	// The map is ready once everything within this distance of the player start is spawned
+	UPROPERTY(EditDefaultsOnly, Category="Spawn Settings", meta=(ClampMin="0"))
+	float ReadyRadius = 5000.f;
+	
 	UPROPERTY(EditDefaultsOnly, Category="Balls settings")
 	TSubclassOf<AActor> _ballActorClass;
 
@@ -113,8 +434,48 @@ private:
 	UPROPERTY(EditDefaultsOnly, Category="Balls settings")
 	int32 _ballCount = 0;
 
+	// Minimum distance between two balls, lowered step by step when the map is too small for _ballCount
+	UPROPERTY(EditDefaultsOnly, Category="Balls settings", meta=(ClampMin="0"))
+	float BallMinDistance = 300.f;
+
+	// Minimum distance between a ball and a wall
+	UPROPERTY(EditDefaultsOnly, Category="Balls settings", meta=(ClampMin="0"))
+	float BallWallClearance = 100.f;
+
+	// Relative ball density of the rooms made of each pavage piece type, 1 when missing
+	UPROPERTY(EditDefaultsOnly, Category="Balls settings", meta=(EditCondition="UsesPavage"))
+	TMap<int32, float> BallDensityByPieceType;
+
 	bool _isMapReady = false;
+	int32 _activeSeed = 0;
 	FVector _playerStartPosition = FVector::Zero();
 	FVector _ghostPosition = FVector::Zero();;
+	TArray<FVector> _ballPositions;
+	// Sorted farthest first, the next element to spawn is the last one
+	TArray<FPendingMapElement> _spawnQueue;
+	int32 _spawnQueueTotal = 0;
+	FRandomStream _meshStream;
+	std::shared_ptr<map_chunks_t> _chunks;
+	// Kept for RegenerateRegion, only for maze maps
+	std::shared_ptr<map_t> _maze;
+	// Streamed maze with rows left to spawn, only with StreamMazeRows
+	std::shared_ptr<maze_stream_t> _mazeStream;
+	int32 _streamedWallsQueued = 0;
+	TArray<EChunkState> _chunkStates;
+	// Building or loaded
+	TSet<int32> _activeChunks;
+	int32 _chunksBuilding = 0;
+	// Building chunks whose cells changed since their build started, built again once it's done
+	TSet<int32> _staleChunks;
+	// Balls of every chunk, by spawn position then by where they were when a chunk last unloaded
+	TArray<TArray<int32>> _chunkBalls;
+	// A ball destroyed by anything but its chunk unloading was picked up, it isn't spawned again
+	TArray<TWeakObjectPtr<AActor>> _ballActors;
+	TWeakObjectPtr<AActor> _hauntedBall;
+	TMap<FMapElementKey, TWeakObjectPtr<UStaticMeshComponent>> _meshElements;
+	TMap<FMapElementKey, TWeakObjectPtr<UStaticMeshComponent>> _retiredElements;
+	TArray<TWeakObjectPtr<UProceduralMeshComponent>> _floorRects;
+	// Bumped by every GenerateMap, results of the tasks started for an older map are dropped
+	int32 _mapGeneration = 0;
 
 };
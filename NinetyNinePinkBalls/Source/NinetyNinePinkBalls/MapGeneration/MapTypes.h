@@ -0,0 +1,223 @@
+﻿#pragma once
+
+// Types shared by the map generators. This header (and the generators built on
+// it) only depends on the standard library so that the scripts in /scripts can
+// compile it outside of Unreal by defining MAPGEN_STANDALONE.
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifdef MAPGEN_STANDALONE
+template<typename T>
+struct TVector{ T X; T Y; T Z; };
+
+using FVector = TVector<double>;
+#else
+#include "CoreMinimal.h"
+#endif
+
+using vector_t = FVector;
+
+
+struct point_t {
+  int x, y;
+
+  bool operator==(const point_t& oth) const {
+    return x == oth.x && y == oth.y;
+  }
+
+  bool operator<(const point_t& oth) const {
+    if (x != oth.x) return x < oth.x;
+    return y < oth.y;
+  }
+};
+
+inline constexpr std::array<point_t, 4> direction = {{
+  {-1, 0}, {1, 0}, {0, 1}, {0, -1}
+}};
+
+enum class wall_orientation { H, V };
+
+// SplitMix64 generator. std::mt19937 is portable but the std distributions
+// and std::shuffle are implementation defined, so the generators only draw
+// through this class to get the same map for a seed on every platform.
+class rng_t {
+  uint64_t state;
+
+public:
+  explicit rng_t(uint64_t seed = 0) : state(seed) {}
+
+  // Independent generator for (seed, key), e.g. one per tile of a map
+  // generated in parallel. SplitMix64 is a counter, the key only picks where
+  // the counter starts.
+  [[nodiscard]] static rng_t stream(uint64_t seed, uint64_t key) {
+    rng_t mixer(seed ^ (key * 0xD1B54A32D192ED03ull));
+    mixer.next();
+    return rng_t(mixer.next());
+  }
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform integer in [lo, hi], Lemire's multiply and shift with rejection
+  // so there is no modulo bias.
+  int uniform(int lo, int hi) {
+    const uint32_t range = static_cast<uint32_t>(static_cast<int64_t>(hi) - lo) + 1;
+    if (range == 0) return static_cast<int>(next() >> 32);
+
+    uint64_t m = (next() >> 32) * range;
+    uint32_t low = static_cast<uint32_t>(m);
+    if (low < range) {
+      const uint32_t floor = (0u - range) % range;
+      while (low < floor) {
+        m = (next() >> 32) * range;
+        low = static_cast<uint32_t>(m);
+      }
+    }
+    return static_cast<int>(static_cast<int64_t>(lo) + static_cast<int64_t>(m >> 32));
+  }
+
+  bool coin() { return next() >> 63; }
+
+  // Uniform double in [0, 1).
+  double unit() { return (next() >> 11) * 0x1.0p-53; }
+
+  template<typename T>
+  void shuffle(std::vector<T>& values) {
+    for (size_t k = values.size(); k > 1; --k) {
+      std::swap(values[k - 1], values[uniform(0, static_cast<int>(k) - 1)]);
+    }
+  }
+};
+
+// Random point around the centre of the cell (rx, ry), far enough from the
+// cell edges not to spawn inside a wall.
+inline vector_t random_point_in_cell(rng_t& rng, int rx, int ry, int segment_length) {
+  const int spread = static_cast<int>(segment_length * 0.75 / 2);
+  const int ox = rng.uniform(-spread, spread);
+  const int oy = rng.uniform(-spread, spread);
+
+  return vector_t{
+    rx * segment_length + segment_length / 2.0 + ox,
+    ry * segment_length + segment_length / 2.0 + oy,
+    0.0
+  };
+}
+
+// Same in a random cell of the grid.
+inline vector_t random_point_in_grid(rng_t& rng, int width, int height, int segment_length) {
+  const int rx = rng.uniform(0, width - 1);
+  const int ry = rng.uniform(0, height - 1);
+  return random_point_in_cell(rng, rx, ry, segment_length);
+}
+
+// Flat union-find with path halving and union by size.
+class disjoint_set_t {
+  std::vector<int> parent;
+  std::vector<int> size;
+
+public:
+  explicit disjoint_set_t(int n) : parent(n), size(n, 1) {
+    for (int i = 0; i < n; ++i) parent[i] = i;
+  }
+
+  int find(int x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  bool unite(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) return false;
+    if (size[a] < size[b]) std::swap(a, b);
+    parent[b] = a;
+    size[a] += size[b];
+    return true;
+  }
+};
+
+// FNV-1a over raw bytes, used to fingerprint generated maps.
+class fnv1a_t {
+  uint64_t hash = 0xCBF29CE484222325ull;
+
+public:
+  template<typename T>
+  void add(const T& value) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+    for (size_t k = 0; k < sizeof(T); ++k) {
+      hash ^= bytes[k];
+      hash *= 0x100000001B3ull;
+    }
+  }
+
+  [[nodiscard]] uint64_t value() const { return hash; }
+};
+
+// Dense 2D bitset. Each row is padded to a whole number of 64-bit words so a
+// row can be read word by word.
+class bit_plane_t {
+  int rows = 0;
+  int cols = 0;
+  int stride = 0;
+  std::vector<uint64_t> words;
+
+public:
+  bit_plane_t() = default;
+
+  bit_plane_t(int r, int c, bool value = false)
+      : rows(r), cols(c), stride((c + 63) / 64),
+        words(static_cast<size_t>(r) * ((c + 63) / 64), value ? ~uint64_t{0} : 0) {
+    if (value && (cols & 63)) {
+      const uint64_t tail = (uint64_t{1} << (cols & 63)) - 1;
+      for (int i = 0; i < rows; ++i) {
+        words[static_cast<size_t>(i) * stride + stride - 1] &= tail;
+      }
+    }
+  }
+
+  [[nodiscard]] int row_count() const { return rows; }
+  [[nodiscard]] int col_count() const { return cols; }
+  [[nodiscard]] int words_per_row() const { return stride; }
+
+  [[nodiscard]] bool test(int i, int j) const {
+    return (words[index(i, j)] >> (j & 63)) & 1;
+  }
+
+  void set(int i, int j) { words[index(i, j)] |= bit(j); }
+  void reset(int i, int j) { words[index(i, j)] &= ~bit(j); }
+
+  void assign(int i, int j, bool value) {
+    if (value) set(i, j);
+    else reset(i, j);
+  }
+
+  [[nodiscard]] const uint64_t* row(int i) const {
+    return words.data() + static_cast<size_t>(i) * stride;
+  }
+
+  [[nodiscard]] size_t count() const {
+    size_t total = 0;
+    for (uint64_t w : words) total += std::popcount(w);
+    return total;
+  }
+
+  [[nodiscard]] size_t memory_size() const { return words.size() * sizeof(uint64_t); }
+
+private:
+  [[nodiscard]] size_t index(int i, int j) const {
+    return static_cast<size_t>(i) * stride + (j >> 6);
+  }
+
+  [[nodiscard]] static uint64_t bit(int j) { return uint64_t{1} << (j & 63); }
+};
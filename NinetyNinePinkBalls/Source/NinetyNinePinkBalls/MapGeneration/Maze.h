@@ -0,0 +1,977 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BallPlacement.h"
+#include "Colliders.h"
+#include "DistanceField.h"
+#include "FloorRects.h"
+#include "MapTypes.h"
+#include "WallGrid.h"
+
+struct collider_t {
+  vector_t centroid;
+  wall_orientation orientation;
+  double length;
+
+  collider_t(const vector_t& c, wall_orientation o, double l)
+      : centroid(c), orientation(o), length(l) {}
+
+  [[nodiscard]] std::array<vector_t, 2> get_endpoints() const {
+    if (orientation == wall_orientation::H) {
+      return {{
+        {centroid.X - length / 2, centroid.Y, centroid.Z},
+        {centroid.X + length / 2, centroid.Y, centroid.Z}
+      }};
+    } else {
+      return {{
+        {centroid.X, centroid.Y - length / 2, centroid.Z},
+        {centroid.X, centroid.Y + length / 2, centroid.Z}
+      }};
+    }
+  }
+
+  [[nodiscard]] double get_angle() const {
+    return (orientation == wall_orientation::H) ? 0.0 : std::numbers::pi / 2;
+  }
+};
+
+// Collider of a single cell edge that appeared or disappeared, see
+// map_t::regenerate_region.
+struct wall_change_t {
+  collider_t wall;
+  bool added;
+};
+
+// Key of the rng streams of regenerated regions.
+inline constexpr uint64_t region_stream_key = 0x5E610;
+
+// Spanning tree used to carve the maze before the pruning pass.
+//  - prim: randomized Prim, many short dead ends.
+//  - kruskal: randomized Kruskal over a flat union-find, similar texture to prim.
+//  - wilson: loop-erased random walks, uniform over all spanning trees.
+//  - backtracker: depth-first search, long winding corridors.
+enum class maze_algorithm { prim, kruskal, wilson, backtracker };
+
+// Pruning settings for a rectangle of the map, in cells (x is the column and y
+// the row). A window uses the settings of the last region containing its top
+// left cell.
+struct prune_region_t {
+  int x, y, width, height;
+  int window = 4;
+  int threshold = 30;
+
+  [[nodiscard]] bool contains(int i, int j) const {
+    return i >= y && i < y + height && j >= x && j < x + width;
+  }
+};
+
+struct map_config_t {
+  int width;
+  int height;
+  int segment_length;
+  int threshold;
+  maze_algorithm algorithm = maze_algorithm::prim;
+  int prune_window = 4;
+  // Windows outside every region use prune_window and threshold.
+  std::vector<prune_region_t> prune_regions{};
+  // Emit runs of adjacent collinear walls as one long collider.
+  bool merge_walls = false;
+  // Every random draw of the generator derives from this seed, the same
+  // config gives the same map on every platform.
+  uint64_t seed = 0;
+  // Above 0 the maze is carved and pruned in tiles of about tile_size cells
+  // (rounded up to a multiple of 64) and its colliders emitted in bands of
+  // that size, on `threads` workers, 0 uses one per core. The result only
+  // depends on the seed and the tile size.
+  int tile_size = 0;
+  int threads = 0;
+  // Off when only the grid is read, e.g. for chunk meshes. The collider list
+  // is most of the memory of a large map.
+  bool colliders = true;
+};
+
+// 2D Fenwick tree over per-cell values: point update and rectangle sum in
+// O(log(rows) * log(cols)).
+class fenwick_2d_t {
+  int rows;
+  int cols;
+  std::vector<int> tree;
+
+public:
+  fenwick_2d_t(int r, int c) : rows(r), cols(c), tree(static_cast<size_t>(r) * c, 0) {}
+
+  // Fill with set_initial() then call build() once, O(rows * cols) instead of
+  // one add() per cell.
+  void set_initial(int i, int j, int value) { tree[index(i, j)] = value; }
+
+  void build() {
+    for (int i = 0; i < rows; ++i) {
+      for (int j = 0; j < cols; ++j) {
+        int parent = j | (j + 1);
+        if (parent < cols) tree[index(i, parent)] += tree[index(i, j)];
+      }
+    }
+    for (int i = 0; i < rows; ++i) {
+      int parent = i | (i + 1);
+      if (parent >= rows) continue;
+      for (int j = 0; j < cols; ++j) tree[index(parent, j)] += tree[index(i, j)];
+    }
+  }
+
+  void add(int i, int j, int delta) {
+    for (int a = i; a < rows; a |= a + 1) {
+      for (int b = j; b < cols; b |= b + 1) tree[index(a, b)] += delta;
+    }
+  }
+
+  // Sum over the rows [0, i) and the columns [0, j).
+  [[nodiscard]] int prefix(int i, int j) const {
+    int total = 0;
+    for (int a = i - 1; a >= 0; a = (a & (a + 1)) - 1) {
+      for (int b = j - 1; b >= 0; b = (b & (b + 1)) - 1) total += tree[index(a, b)];
+    }
+    return total;
+  }
+
+  // Sum over the rows [i0, i1) and the columns [j0, j1). The prefix chains of
+  // both bounds are walked together and stop where they meet, so a small
+  // window only touches a handful of nodes instead of four full prefixes.
+  [[nodiscard]] int sum(int i0, int j0, int i1, int j1) const {
+    std::array<node_t, 64> row_nodes, col_nodes;
+    int row_count = range_nodes(i0, i1, row_nodes);
+    int col_count = range_nodes(j0, j1, col_nodes);
+
+    int total = 0;
+    for (int a = 0; a < row_count; ++a) {
+      int row_total = 0;
+      for (int b = 0; b < col_count; ++b) {
+        row_total += col_nodes[b].sign * tree[index(row_nodes[a].at, col_nodes[b].at)];
+      }
+      total += row_nodes[a].sign * row_total;
+    }
+    return total;
+  }
+
+private:
+  struct node_t { int at; int sign; };
+
+  static int range_nodes(int lo, int hi, std::array<node_t, 64>& nodes) {
+    int count = 0;
+    int r = hi - 1;
+    int l = lo - 1;
+    while (r != l) {
+      if (r > l) {
+        nodes[count++] = {r, 1};
+        r = (r & (r + 1)) - 1;
+      } else {
+        nodes[count++] = {l, -1};
+        l = (l & (l + 1)) - 1;
+      }
+    }
+    return count;
+  }
+
+  [[nodiscard]] size_t index(int i, int j) const { return static_cast<size_t>(i) * cols + j; }
+};
+
+// Carves a spanning tree over the cells of a rectangle of the grid. Only the
+// edges strictly inside of the rectangle are touched, its border and the rest
+// of the grid keep their walls.
+class maze_carver_t {
+  wall_grid_t& grid;
+  rng_t& rng;
+  int x0;
+  int y0;
+  int width;
+  int height;
+
+public:
+  maze_carver_t(wall_grid_t& g, rng_t& r, const grid_rect_t& rect)
+      : grid(g), rng(r), x0(rect.x), y0(rect.y), width(rect.width), height(rect.height) {}
+
+  // `s` is the starting cell (row, column) relative to the rectangle.
+  void carve(maze_algorithm algorithm, point_t s) {
+    switch (algorithm) {
+      case maze_algorithm::prim: prim(s); break;
+      case maze_algorithm::kruskal: kruskal(); break;
+      case maze_algorithm::wilson: wilson(s); break;
+      case maze_algorithm::backtracker: backtracker(s); break;
+    }
+  }
+
+private:
+  int random_int(int lo, int hi) { return rng.uniform(lo, hi); }
+
+  [[nodiscard]] int cell_index(int i, int j) const { return i * width + j; }
+
+  // Neighbour of `cell` in `dir`, or -1 when it falls outside of the rectangle.
+  [[nodiscard]] int neighbour(int cell, int dir) const {
+    int i = cell / width + direction[dir].x;
+    int j = cell % width + direction[dir].y;
+    return i >= 0 && i < height && j >= 0 && j < width ? cell_index(i, j) : -1;
+  }
+
+  void remove_wall(int cell, int dir) {
+    grid.remove_wall(y0 + cell / width, x0 + cell % width, dir);
+  }
+
+  // Frontier edges are packed as (cell << 2 | dir) and popped with a swap
+  // with the last element, so every pop is O(1).
+  void prim(point_t s) {
+    std::vector<uint8_t> visited(static_cast<size_t>(width) * height, 0);
+    std::vector<uint32_t> frontier;
+
+    auto visit = [&](int cell) {
+      visited[cell] = 1;
+      for (int dir = 0; dir < 4; ++dir) {
+        int next = neighbour(cell, dir);
+        if (next >= 0 && !visited[next])
+          frontier.push_back(static_cast<uint32_t>(cell) << 2 | dir);
+      }
+    };
+
+    visit(cell_index(s.x, s.y));
+
+    while (!frontier.empty()) {
+      size_t idx = random_int(0, static_cast<int>(frontier.size()) - 1);
+      uint32_t edge = frontier[idx];
+      frontier[idx] = frontier.back();
+      frontier.pop_back();
+
+      int cell = static_cast<int>(edge >> 2);
+      int dir = static_cast<int>(edge & 3);
+      int next = neighbour(cell, dir);
+
+      if (!visited[next]) {
+        remove_wall(cell, dir);
+        visit(next);
+      }
+    }
+  }
+
+  // Interior edges are packed as (cell << 1 | south) where the edge is the
+  // east wall of `cell` when south is 0 and its south wall otherwise.
+  void kruskal() {
+    std::vector<uint32_t> edges;
+    edges.reserve(2 * static_cast<size_t>(width) * height);
+    for (int i = 0; i < height; ++i) {
+      for (int j = 0; j < width; ++j) {
+        uint32_t cell = cell_index(i, j);
+        if (j + 1 < width) edges.push_back(cell << 1);
+        if (i + 1 < height) edges.push_back(cell << 1 | 1);
+      }
+    }
+
+    rng.shuffle(edges);
+
+    disjoint_set_t sets(width * height);
+    int remaining = width * height - 1;
+    for (uint32_t edge : edges) {
+      if (remaining == 0) break;
+      int cell = static_cast<int>(edge >> 1);
+      int dir = (edge & 1) ? 1 : 2;
+      if (sets.unite(cell, neighbour(cell, dir))) {
+        remove_wall(cell, dir);
+        --remaining;
+      }
+    }
+  }
+
+  // Each walk keeps only the last direction taken out of every cell, which
+  // erases its loops implicitly once it is replayed into the tree.
+  void wilson(point_t s) {
+    const int cells = width * height;
+    std::vector<uint8_t> in_tree(cells, 0);
+    std::vector<uint8_t> next_dir(cells, 0);
+
+    in_tree[cell_index(s.x, s.y)] = 1;
+
+    for (int origin = 0; origin < cells; ++origin) {
+      if (in_tree[origin]) continue;
+
+      int cell = origin;
+      while (!in_tree[cell]) {
+        int dir, next;
+        do {
+          dir = random_int(0, 3);
+          next = neighbour(cell, dir);
+        } while (next < 0);
+        next_dir[cell] = static_cast<uint8_t>(dir);
+        cell = next;
+      }
+
+      cell = origin;
+      while (!in_tree[cell]) {
+        in_tree[cell] = 1;
+        remove_wall(cell, next_dir[cell]);
+        cell = neighbour(cell, next_dir[cell]);
+      }
+    }
+  }
+
+  // Iterative depth-first search, the stack grows up to width * height on
+  // large maps so it can't be recursive.
+  void backtracker(point_t s) {
+    std::vector<uint8_t> visited(static_cast<size_t>(width) * height, 0);
+    std::vector<int> stack;
+
+    int start = cell_index(s.x, s.y);
+    visited[start] = 1;
+    stack.push_back(start);
+
+    while (!stack.empty()) {
+      int cell = stack.back();
+
+      std::array<int, 4> candidates;
+      int count = 0;
+      for (int dir = 0; dir < 4; ++dir) {
+        int next = neighbour(cell, dir);
+        if (next >= 0 && !visited[next]) candidates[count++] = dir;
+      }
+
+      if (count == 0) {
+        stack.pop_back();
+        continue;
+      }
+
+      int dir = candidates[random_int(0, count - 1)];
+      int next = neighbour(cell, dir);
+      remove_wall(cell, dir);
+      visited[next] = 1;
+      stack.push_back(next);
+    }
+  }
+};
+
+class map_t {
+private:
+  int width;
+  int height;
+  int segment_length;
+  int threshold = 30;
+  int prune_window = 4;
+  std::vector<prune_region_t> prune_regions;
+  bool merge_walls = false;
+  maze_algorithm algorithm = maze_algorithm::prim;
+  uint64_t seed = 0;
+  int tile_size = 0;
+  int threads = 0;
+  wall_grid_t grid;
+  vector_t start;
+  collider_buffer_t walls;
+
+  rng_t rng;
+
+public:
+  [[nodiscard]] vector_t centroid() const { return start; }
+
+  // Every cell of a maze is walkable, same interface as pavage::placement_t
+  // without the index. Returns (row, column).
+  point_t retrieve_safe_cell() {
+    int col = rng.uniform(0, width - 1);
+    int row = rng.uniform(0, height - 1);
+    return {row, col};
+  }
+
+  vector_t retrieve_safe_point() {
+    point_t cell = retrieve_safe_cell();
+    return random_point_in_cell(rng, cell.y, cell.x, segment_length);
+  }
+
+  // Player in a random cell and ghost at a path distance in [min_distance,
+  // max_distance] cells from it, see place_spawn_points.
+  spawn_points_t retrieve_spawn_points(int min_distance, int max_distance) {
+    return place_spawn_points(emitted_grid(), rng, retrieve_safe_cell(), segment_length, min_distance, max_distance);
+  }
+
+  // Poisson-disk ball positions, every cell of the maze is one room.
+  std::vector<vector_t> retrieve_balls(const ball_placement_config_t& config) const {
+    rng_t ball_rng = rng_t::stream(seed, ball_stream_key);
+    ball_placer_t placer(emitted_grid(), std::vector<int>(static_cast<size_t>(width) * height, 0), segment_length);
+    return placer.place(config, ball_rng);
+  }
+
+  // Every cell of the maze has a floor, it's a single rectangle.
+  [[nodiscard]] std::vector<floor_rect_t> retrieve_floor() const {
+    return merge_floor_cells(std::vector<int>(static_cast<size_t>(width) * height, 0), width, height);
+  }
+
+  [[nodiscard]] const collider_buffer_t& get_walls() const { return walls; }
+  [[nodiscard]] const wall_grid_t& get_grid() const { return grid; }
+
+  // Whether the edge on the north (horizontal) or west side of (i, j) gets a
+  // collider, (i, j) may be one past the last row or column.
+  [[nodiscard]] bool emits_wall(int i, int j, bool horizontal) const {
+    return horizontal ? emitted_h(i, j) : emitted_v(i, j);
+  }
+
+  // Only the walls that get a collider, the maze as it is played. get_grid()
+  // also holds the single walls that emits() drops, the chunk meshes, the
+  // distance field and the balls read this one so they match the colliders.
+  [[nodiscard]] wall_grid_t emitted_grid() const {
+    wall_grid_t emitted = grid;
+    for (int i = 1; i + 1 < height; ++i) {
+      for (int j = 1; j + 1 < width; ++j) {
+        if (grid.wall_count(i, j) != 1) continue;
+        for (int dir = 0; dir < 4; ++dir) {
+          if (grid.is_wall(i, j, dir) && !emits(i + direction[dir].x, j + direction[dir].y)) {
+            emitted.remove_wall(i, j, dir);
+          }
+        }
+      }
+    }
+    return emitted;
+  }
+
+  // Sets the four edges of every cell of `area` in `to` to the emitted walls,
+  // to update a copy of emitted_grid() after regenerate_region.
+  void copy_emitted(wall_grid_t& to, grid_rect_t area) const {
+    area = area.clamped(width, height);
+    for (int i = area.y; i < area.y + area.height; ++i) {
+      for (int j = area.x; j < area.x + area.width; ++j) {
+        to.set_wall(i, j, 0, emitted_h(i, j));
+        to.set_wall(i, j, 1, emitted_h(i + 1, j));
+        to.set_wall(i, j, 2, emitted_v(i, j + 1));
+        to.set_wall(i, j, 3, emitted_v(i, j));
+      }
+    }
+  }
+
+  // Carves `area` again as a new maze drawn from (seed, region_seed) and
+  // prunes it like the rest of the map. The walls on the border of the area
+  // are kept so every path that went through it still does, one is opened
+  // when it had no opening. Returns the cell edges whose collider appeared or
+  // disappeared, the work only depends on the size of the area. get_walls()
+  // keeps describing the map as it was generated.
+  std::vector<wall_change_t> regenerate_region(grid_rect_t area, uint64_t region_seed) {
+    area = area.clamped(width, height);
+    if (area.width <= 0 || area.height <= 0) return {};
+    const int x1 = area.x + area.width;
+    const int y1 = area.y + area.height;
+
+    // Colliders depend on the wall count of the cells on both sides, opening
+    // the border changes the cells around the area too.
+    const grid_rect_t ring = grid_rect_t{area.x - 1, area.y - 1, area.width + 2, area.height + 2}.clamped(width, height);
+    auto snapshot = [&] {
+      std::vector<uint8_t> edges;
+      edges.reserve(2 * static_cast<size_t>(ring.width + 1) * (ring.height + 1));
+      for (int i = ring.y; i <= ring.y + ring.height; ++i) {
+        for (int j = ring.x; j <= ring.x + ring.width; ++j) {
+          edges.push_back(j < ring.x + ring.width && emitted_h(i, j));
+          edges.push_back(i < ring.y + ring.height && emitted_v(i, j));
+        }
+      }
+      return edges;
+    };
+    const std::vector<uint8_t> before = snapshot();
+
+    rng_t region_rng = rng_t::stream(rng_t::stream(seed, region_stream_key).next(), region_seed);
+    for (int i = area.y; i < y1; ++i) {
+      for (int j = area.x; j < x1; ++j) {
+        if (i > area.y) grid.set_wall(i, j, 0, true);
+        if (j > area.x) grid.set_wall(i, j, 3, true);
+      }
+    }
+    point_t s{region_rng.uniform(0, area.height - 1), region_rng.uniform(0, area.width - 1)};
+    maze_carver_t{grid, region_rng, area}.carve(algorithm, s);
+    prune(area, region_rng);
+    open_border(area, region_rng);
+
+    const std::vector<uint8_t> after = snapshot();
+    std::vector<wall_change_t> changes;
+    size_t k = 0;
+    for (int i = ring.y; i <= ring.y + ring.height; ++i) {
+      for (int j = ring.x; j <= ring.x + ring.width; ++j, k += 2) {
+        if (before[k] != after[k]) {
+          changes.push_back({collider_t(vector_t{(j + 0.5) * segment_length, static_cast<double>(i * segment_length), 0.0},
+            wall_orientation::H, static_cast<double>(segment_length)), after[k] != 0});
+        }
+        if (before[k + 1] != after[k + 1]) {
+          changes.push_back({collider_t(vector_t{static_cast<double>(j * segment_length), (i + 0.5) * segment_length, 0.0},
+            wall_orientation::V, static_cast<double>(segment_length)), after[k + 1] != 0});
+        }
+      }
+    }
+    return changes;
+  }
+
+  map_t(const map_config_t& config)
+      : width(config.width), height(config.height), segment_length(config.segment_length),
+        threshold(config.threshold), prune_window(config.prune_window), prune_regions(config.prune_regions),
+        merge_walls(config.merge_walls), algorithm(config.algorithm), seed(config.seed),
+        tile_size(config.tile_size), threads(config.threads), grid(config.width, config.height),
+        rng(config.seed) {
+    carve({random_int(0, height - 1), random_int(0, width - 1)});
+    // Tiled maps are pruned by carve_tiled.
+    if (tile_size <= 0) random_remove_wall();
+    if (config.colliders) generate_colliders();
+  }
+
+  [[nodiscard]] std::string latex() const {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2);
+
+    oss << "\\documentclass[margin=5mm,tikz]{standalone}\n"
+        << "\\usepackage{tikz}\n"
+        << "\\begin{document}\n";
+
+    oss << "\\begin{tikzpicture}[scale=0.5]\n";
+    for (size_t k = 0; k < walls.size(); ++k) {
+      const vector_t c = walls.centroid(k);
+      double half = walls.length(k) / 2.0;
+
+      if (!walls.is_vertical(k)) {
+        oss << "\\draw (" << c.X - half << "," << c.Y << ") -- ("
+            << c.X + half << "," << c.Y << ");\n";
+      } else {
+        oss << "\\draw (" << c.X << "," << c.Y - half << ") -- ("
+            << c.X << "," << c.Y + half << ");\n";
+      }
+    }
+
+    oss << "\\end{tikzpicture}\n\\end{document}";
+
+    return oss.str();
+  }
+
+private:
+  int random_int(int lo, int hi) { return rng.uniform(lo, hi); }
+
+  void carve(point_t s) {
+    if (tile_size > 0) {
+      carve_tiled();
+      return;
+    }
+    maze_carver_t{grid, rng, {0, 0, width, height}}.carve(algorithm, s);
+  }
+
+  [[nodiscard]] int tile_cells() const { return (tile_size + 63) / 64 * 64; }
+
+  // Runs task(0) to task(count - 1) on `threads` workers, 0 uses one per core.
+  template<typename F>
+  void parallel_for(int count, F&& task) const {
+    std::atomic<int> next{0};
+    auto work = [&] {
+      for (int k = next++; k < count; k = next++) task(k);
+    };
+
+    int workers = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+    workers = std::clamp(workers, 1, std::max(count, 1));
+    std::vector<std::thread> pool;
+    for (int k = 1; k < workers; ++k) pool.emplace_back(work);
+    work();
+    for (auto& worker : pool) worker.join();
+  }
+
+  // Every tile is carved on its own by a worker with an rng stream keyed by
+  // (seed, tile), then the tiles are joined by a random spanning tree over the
+  // tile graph with one opening per tree edge. The windows across the tile
+  // borders are pruned next, before the tiles: pruned tiles would leave them
+  // under the threshold and the seams denser than the rest. Last the workers
+  // prune the windows inside each tile. The tiles only write the edges
+  // strictly inside of them and start on a word boundary of the bit planes,
+  // so the workers never share a word and the result doesn't depend on the
+  // number of threads.
+  void carve_tiled() {
+    const int tile = tile_cells();
+    const int tiles_x = (width + tile - 1) / tile;
+    const int tiles_y = (height + tile - 1) / tile;
+    const int tiles = tiles_x * tiles_y;
+
+    auto tile_rect = [&](int t) {
+      int x = (t % tiles_x) * tile;
+      int y = (t / tiles_x) * tile;
+      return grid_rect_t{x, y, std::min(tile, width - x), std::min(tile, height - y)};
+    };
+
+    std::vector<rng_t> tile_rngs(tiles);
+    parallel_for(tiles, [&](int t) {
+      grid_rect_t rect = tile_rect(t);
+      tile_rngs[t] = rng_t::stream(seed, static_cast<uint64_t>(t));
+      point_t s{tile_rngs[t].uniform(0, rect.height - 1), tile_rngs[t].uniform(0, rect.width - 1)};
+      maze_carver_t{grid, tile_rngs[t], rect}.carve(algorithm, s);
+    });
+
+    // Tile edges packed as (tile << 1 | south) like kruskal's cell edges.
+    std::vector<uint32_t> edges;
+    for (int t = 0; t < tiles; ++t) {
+      if (t % tiles_x + 1 < tiles_x) edges.push_back(static_cast<uint32_t>(t) << 1);
+      if (t / tiles_x + 1 < tiles_y) edges.push_back(static_cast<uint32_t>(t) << 1 | 1);
+    }
+
+    rng_t join_rng = rng_t::stream(seed, ~uint64_t{0});
+    join_rng.shuffle(edges);
+
+    disjoint_set_t sets(tiles);
+    for (uint32_t edge : edges) {
+      int t = static_cast<int>(edge >> 1);
+      bool south = edge & 1;
+      if (!sets.unite(t, south ? t + tiles_x : t + 1)) continue;
+
+      grid_rect_t rect = tile_rect(t);
+      if (south) {
+        grid.remove_wall(rect.y + rect.height - 1, join_rng.uniform(rect.x, rect.x + rect.width - 1), 1);
+      } else {
+        grid.remove_wall(join_rng.uniform(rect.y, rect.y + rect.height - 1), rect.x + rect.width - 1, 2);
+      }
+    }
+    prune_seams(join_rng);
+    parallel_for(tiles, [&](int t) { prune(tile_rect(t), tile_rngs[t]); });
+  }
+
+  [[nodiscard]] std::pair<int, int> prune_settings(int i, int j) const {
+    std::pair<int, int> settings{prune_window, threshold};
+    for (const auto& region : prune_regions) {
+      if (region.contains(i, j)) settings = {region.window, region.threshold};
+    }
+    return settings;
+  }
+
+  // Single sweep over the windows. The index is updated on every removal so
+  // each window sees the walls removed by the previous ones.
+  void random_remove_wall() { prune({0, 0, width, height}, rng); }
+
+  // Same sweep over the windows of `area` only, walls are only removed
+  // between two cells of the area.
+  void prune(const grid_rect_t& area, rng_t& r) {
+    fenwick_2d_t density(area.height, area.width);
+    for (int i = 0; i < area.height; ++i) {
+      for (int j = 0; j < area.width; ++j) {
+        density.set_initial(i, j, grid.wall_count(area.y + i, area.x + j));
+      }
+    }
+    density.build();
+
+    for (int si = 0; si < area.height; ++si) {
+      for (int sj = 0; sj < area.width; ++sj) {
+        auto [window, limit] = prune_settings(area.y + si, area.x + sj);
+        if (window <= 0 || si + window > area.height || sj + window > area.width) continue;
+        if (density.sum(si, sj, si + window, sj + window) <= limit) continue;
+
+        if (auto removed = remove_in_window(area, si, sj, window, r)) {
+          density.add(removed->first.x, removed->first.y, -1);
+          density.add(removed->second.x, removed->second.y, -1);
+        }
+      }
+    }
+  }
+
+  // Removes a random wall of a random cell of the window at (si, sj) of
+  // `area` when the cell on its other side is in the area too. Returns the
+  // two cells, relative to the area.
+  std::optional<std::pair<point_t, point_t>> remove_in_window(const grid_rect_t& area, int si, int sj, int window, rng_t& r) {
+    int ri = r.uniform(si, si + window - 1);
+    int rj = r.uniform(sj, sj + window - 1);
+
+    const cell_t cell = grid.cell(area.y + ri, area.x + rj);
+    std::array<int, 4> possible_walls;
+    int count = 0;
+    for (int dir = 0; dir < 4; ++dir) {
+      if (cell.is_wall(dir)) possible_walls[count++] = dir;
+    }
+    if (count == 0) return std::nullopt;
+
+    int wall_dir = possible_walls[r.uniform(0, count - 1)];
+    int ni = ri + direction[wall_dir].x;
+    int nj = rj + direction[wall_dir].y;
+    if (ni < 0 || ni >= area.height || nj < 0 || nj >= area.width) return std::nullopt;
+
+    grid.remove_wall(area.y + ri, area.x + rj, wall_dir);
+    return std::pair{point_t{ri, rj}, point_t{ni, nj}};
+  }
+
+  // The windows the tiles didn't prune, the ones across a tile border, in the
+  // order of prune. Only the cells a window from the border can reach are
+  // visited and a window covers a few cells, its walls are counted directly.
+  void prune_seams(rng_t& r) {
+    const int tile = tile_cells();
+    int reach = prune_window;
+    for (const auto& region : prune_regions) reach = std::max(reach, region.window);
+    // Whether a window starting at s can end in the next tile.
+    auto near_border = [&](int s) { return s % tile + reach > tile; };
+
+    const grid_rect_t whole{0, 0, width, height};
+    for (int si = 0; si < height; ++si) {
+      const bool row_seam = near_border(si);
+      for (int sj = 0; sj < width; ++sj) {
+        if (!row_seam && !near_border(sj)) {
+          sj = (sj / tile + 1) * tile - reach;
+          continue;
+        }
+        auto [window, limit] = prune_settings(si, sj);
+        if (window <= 0 || si + window > height || sj + window > width) continue;
+        if (si / tile == (si + window - 1) / tile && sj / tile == (sj + window - 1) / tile) continue;
+
+        int walls_in_window = 0;
+        for (int i = si; i < si + window; ++i) {
+          for (int j = sj; j < sj + window; ++j) walls_in_window += grid.wall_count(i, j);
+        }
+        if (walls_in_window <= limit) continue;
+        remove_in_window(whole, si, sj, window, r);
+      }
+    }
+  }
+
+  // A cell with a single interior wall doesn't emit its walls, they only
+  // appear if the neighbour on the other side emits them.
+  [[nodiscard]] bool emits(int i, int j) const {
+    return i == 0 || j == 0 || i == height - 1 || j == width - 1 ||
+           grid.wall_count(i, j) != 1;
+  }
+
+  [[nodiscard]] bool emitted_h(int i, int j) const {
+    return grid.horizontal().test(i, j) && ((i > 0 && emits(i - 1, j)) || (i < height && emits(i, j)));
+  }
+
+  [[nodiscard]] bool emitted_v(int i, int j) const {
+    return grid.vertical().test(i, j) && ((j > 0 && emits(i, j - 1)) || (j < width && emits(i, j)));
+  }
+
+  // Opens a random edge of the border of `area` when none is open, a region
+  // covering the whole grid has no border.
+  void open_border(const grid_rect_t& area, rng_t& r) {
+    std::vector<std::pair<point_t, int>> border;
+    for (int j = area.x; j < area.x + area.width; ++j) {
+      border.push_back({{area.y, j}, 0});
+      border.push_back({{area.y + area.height - 1, j}, 1});
+    }
+    for (int i = area.y; i < area.y + area.height; ++i) {
+      border.push_back({{i, area.x + area.width - 1}, 2});
+      border.push_back({{i, area.x}, 3});
+    }
+    std::erase_if(border, [&](const std::pair<point_t, int>& edge) {
+      return !grid.in_bounds(edge.first.x + direction[edge.second].x, edge.first.y + direction[edge.second].y);
+    });
+    if (border.empty()) return;
+    for (const auto& [cell, dir] : border) {
+      if (!grid.is_wall(cell.x, cell.y, dir)) return;
+    }
+    const auto& [cell, dir] = border[r.uniform(0, static_cast<int>(border.size()) - 1)];
+    grid.remove_wall(cell.x, cell.y, dir);
+  }
+
+  // Horizontal runs line by line, then vertical runs column by column. A
+  // tiled map emits bands of lines and of columns on the workers and joins
+  // them in that same order, a run never leaves its line or column so the
+  // colliders are the same as emitted in one go.
+  void generate_colliders() {
+    walls = collider_buffer_t(segment_length);
+
+    if (tile_size <= 0) {
+      // Every run holds at least one wall, the count of walls is a bound.
+      walls.reserve(grid.horizontal().count() + grid.vertical().count());
+      emit_lines(walls, 0, height + 1);
+      emit_columns(walls, 0, width + 1);
+      return;
+    }
+
+    const int band = tile_cells();
+    const int line_bands = (height + band) / band;
+    const int column_bands = (width + band) / band;
+    std::vector<collider_buffer_t> parts(line_bands + column_bands, collider_buffer_t(segment_length));
+    parallel_for(line_bands + column_bands, [&](int k) {
+      if (k < line_bands) emit_lines(parts[k], k * band, std::min((k + 1) * band, height + 1));
+      else emit_columns(parts[k], (k - line_bands) * band, std::min((k - line_bands + 1) * band, width + 1));
+    });
+
+    size_t total = 0;
+    for (const auto& part : parts) total += part.size();
+    walls.reserve(total);
+    for (const auto& part : parts) walls.append(part);
+  }
+
+  // Horizontal runs of the grid lines [i0, i1).
+  void emit_lines(collider_buffer_t& out, int i0, int i1) const {
+    // Without merging every run is a single edge.
+    const int max_run = merge_walls ? std::max(width, height) : 1;
+    for (int i = i0; i < i1; ++i) {
+      for (int j = 0; j < width; ++j) {
+        if (!emitted_h(i, j)) continue;
+        int run = 1;
+        while (run < max_run && j + run < width && emitted_h(i, j + run)) ++run;
+
+        out.push_back(j, i, run, wall_orientation::H);
+        j += run - 1;
+      }
+    }
+  }
+
+  // Vertical runs of the grid columns [j0, j1).
+  void emit_columns(collider_buffer_t& out, int j0, int j1) const {
+    const int max_run = merge_walls ? std::max(width, height) : 1;
+    for (int j = j0; j < j1; ++j) {
+      for (int i = 0; i < height; ++i) {
+        if (!emitted_v(i, j)) continue;
+        int run = 1;
+        while (run < max_run && i + run < height && emitted_v(i + run, j)) ++run;
+
+        out.push_back(j, i, run, wall_orientation::V);
+        i += run - 1;
+      }
+    }
+  }
+};
+
+// Streaming maze generator (Eller's algorithm). The maze is built one row at
+// a time and only the set of each column of the current row is kept, so the
+// memory stays O(width) however tall the map is. Each call to next_row()
+// returns the walls of one row: the north edge of its cells, its vertical
+// walls and, for the last row, the south border. The result is a perfect maze,
+// random_remove_wall needs the whole grid and isn't applied.
+class maze_stream_t {
+  int width;
+  int height;
+  int segment_length;
+  int row = 0;
+
+  // Set label of each column, labels are kept in [0, width) by renumbering
+  // them at the end of every row.
+  std::vector<int> sets;
+  std::vector<uint8_t> open_north;
+  std::vector<uint8_t> open_south;
+  std::vector<int> parent;
+  std::vector<int> remap;
+  std::vector<int> members;
+  std::vector<int> picked;
+  std::vector<uint8_t> has_opening;
+  std::vector<collider_t> row_walls;
+
+  rng_t rng;
+
+public:
+  maze_stream_t(const map_config_t& config)
+      : width(config.width), height(config.height), segment_length(config.segment_length),
+        sets(config.width, -1), open_north(config.width, 0), open_south(config.width, 0),
+        parent(config.width), remap(config.width), members(config.width),
+        picked(config.width), has_opening(config.width), rng(config.seed) {
+    row_walls.reserve(2 * static_cast<size_t>(width) + 1);
+  }
+
+  [[nodiscard]] bool done() const { return row >= height; }
+  [[nodiscard]] int current_row() const { return row; }
+
+  vector_t retrieve_safe_point() {
+    return random_point_in_grid(rng, width, height, segment_length);
+  }
+
+  // Calls on_row(row, walls) for every remaining row.
+  template<typename F>
+  void generate(F&& on_row) {
+    while (!done()) {
+      int index = row;
+      on_row(index, next_row());
+    }
+  }
+
+  const std::vector<collider_t>& next_row() {
+    row_walls.clear();
+    if (done()) return row_walls;
+
+    const bool last = row == height - 1;
+
+    // Columns that weren't opened from the row above start their own set.
+    int next_label = 0;
+    for (int j = 0; j < width; ++j) {
+      if (sets[j] >= 0) next_label = std::max(next_label, sets[j] + 1);
+    }
+    for (int j = 0; j < width; ++j) {
+      if (sets[j] < 0) sets[j] = next_label++;
+      parent[j] = j;
+    }
+
+    for (int j = 0; j < width; ++j) {
+      if (!open_north[j]) add_wall(j, row, wall_orientation::H);
+    }
+
+    add_wall(0, row, wall_orientation::V);
+    for (int j = 0; j + 1 < width; ++j) {
+      int a = find(sets[j]);
+      int b = find(sets[j + 1]);
+      if (a != b && (last || coin())) {
+        parent[b] = a;
+      } else {
+        add_wall(j + 1, row, wall_orientation::V);
+      }
+    }
+    add_wall(width, row, wall_orientation::V);
+
+    if (last) {
+      for (int j = 0; j < width; ++j) add_wall(j, row + 1, wall_orientation::H);
+      ++row;
+      return row_walls;
+    }
+
+    // Every set needs at least one opening to the south, the forced one is
+    // picked uniformly among the columns of the set (reservoir sampling).
+    for (int j = 0; j < width; ++j) {
+      members[j] = 0;
+      has_opening[j] = 0;
+    }
+    for (int j = 0; j < width; ++j) {
+      int root = find(sets[j]);
+      open_south[j] = coin();
+      has_opening[root] |= open_south[j];
+      if (random_int(0, members[root]++) == 0) picked[root] = j;
+    }
+    for (int j = 0; j < width; ++j) {
+      int root = find(sets[j]);
+      if (!has_opening[root]) {
+        open_south[picked[root]] = 1;
+        has_opening[root] = 1;
+      }
+    }
+
+    // Carry the sets down and renumber them from 0.
+    std::fill(remap.begin(), remap.end(), -1);
+    int label = 0;
+    for (int j = 0; j < width; ++j) {
+      if (open_south[j]) {
+        int root = find(sets[j]);
+        if (remap[root] < 0) remap[root] = label++;
+        sets[j] = remap[root];
+      } else {
+        sets[j] = -1;
+      }
+    }
+    std::swap(open_north, open_south);
+
+    ++row;
+    return row_walls;
+  }
+
+private:
+  int random_int(int lo, int hi) { return rng.uniform(lo, hi); }
+
+  bool coin() { return rng.coin(); }
+
+  int find(int x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  void add_wall(int j, int i, wall_orientation orientation) {
+    if (orientation == wall_orientation::H) {
+      row_walls.emplace_back(
+        vector_t{j * segment_length + segment_length / 2.0, static_cast<double>(i * segment_length), 0.0},
+        wall_orientation::H, static_cast<double>(segment_length));
+    } else {
+      row_walls.emplace_back(
+        vector_t{static_cast<double>(j * segment_length), i * segment_length + segment_length / 2.0, 0.0},
+        wall_orientation::V, static_cast<double>(segment_length));
+    }
+  }
+};
@@ -0,0 +1,1330 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <iomanip>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <set>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BallPlacement.h"
+#include "CellSampler.h"
+#include "Colliders.h"
+#include "DistanceField.h"
+#include "FloorRects.h"
+#include "MapTypes.h"
+#include "WallGrid.h"
+
+namespace pavage {
+  using shape_t = std::vector<std::pair<int, int>>;
+  using const_ref_shape_t = const shape_t&;
+
+  // Cells of a piece in a fixed-size array, so pieces and their variants are
+  // literal types and the catalog below is expanded at compile time. A piece
+  // fits in a max_extent x max_extent box.
+  struct piece_shape_t {
+    static constexpr int max_extent = 8;
+    static constexpr int max_cells = max_extent * max_extent;
+
+    std::array<std::pair<int, int>, max_cells> cells{};
+    int count = 0;
+
+    constexpr piece_shape_t() = default;
+    constexpr piece_shape_t(std::initializer_list<std::pair<int, int>> list) {
+      for (auto cell : list) push_back(cell);
+    }
+
+    constexpr void push_back(std::pair<int, int> cell) { cells[count++] = cell; }
+    [[nodiscard]] constexpr int size() const { return count; }
+    [[nodiscard]] constexpr auto begin() const { return cells.begin(); }
+    [[nodiscard]] constexpr auto end() const { return cells.begin() + count; }
+    [[nodiscard]] constexpr auto begin() { return cells.begin(); }
+    [[nodiscard]] constexpr auto end() { return cells.begin() + count; }
+
+    [[nodiscard]] constexpr bool operator==(const piece_shape_t& other) const {
+      return std::equal(begin(), end(), other.begin(), other.end());
+    }
+  };
+
+  // Variant of a piece moved to the origin, its cells sorted, with its row
+  // masks: bit c of rows[r] stands for the cell (c, r). `halo` holds the
+  // cells next to it, from the row above to the row below, bit 0 standing for
+  // the column left of the variant.
+  struct variant_t {
+    piece_shape_t shape;
+    int width = 0;
+    int height = 0;
+    std::array<uint64_t, piece_shape_t::max_extent> rows{};
+    std::array<uint64_t, piece_shape_t::max_extent + 2> halo{};
+
+    [[nodiscard]] constexpr auto begin() const { return shape.begin(); }
+    [[nodiscard]] constexpr auto end() const { return shape.end(); }
+  };
+
+  struct piece_variants_t {
+    std::array<variant_t, 8> variants{};
+    int count = 0;
+
+    [[nodiscard]] constexpr int size() const { return count; }
+    [[nodiscard]] constexpr const variant_t& operator[](int v) const { return variants[v]; }
+    [[nodiscard]] constexpr auto begin() const { return variants.begin(); }
+    [[nodiscard]] constexpr auto end() const { return variants.begin() + count; }
+  };
+
+  // Rotations and reflections of a shape without duplicates, the four
+  // rotations then those of the mirror image. Shapes that repeat a cell or
+  // don't fit in a max_extent box have no variant.
+  [[nodiscard]] constexpr piece_variants_t expand_variants(const piece_shape_t& shape) {
+    piece_variants_t result;
+    if (shape.size() == 0) return result;
+    piece_shape_t current = shape;
+
+    for (int flip = 0; flip < 2; ++flip) {
+      for (int rot = 0; rot < 4; ++rot) {
+        int minx = INT_MAX, miny = INT_MAX;
+        for (auto [x, y] : current) {
+          minx = std::min(minx, x);
+          miny = std::min(miny, y);
+        }
+
+        // Built in place, only kept when it's new.
+        variant_t& variant = result.variants[result.count];
+        variant = {};
+        for (auto [x, y] : current) {
+          variant.shape.push_back({x - minx, y - miny});
+          variant.width = std::max(variant.width, x - minx + 1);
+          variant.height = std::max(variant.height, y - miny + 1);
+        }
+        if (variant.width > piece_shape_t::max_extent || variant.height > piece_shape_t::max_extent) return {};
+        std::sort(variant.shape.begin(), variant.shape.end());
+        if (std::adjacent_find(variant.shape.begin(), variant.shape.end()) != variant.shape.end()) return {};
+
+        bool repeated = false;
+        for (int v = 0; v < result.count; ++v) repeated = repeated || result.variants[v].shape == variant.shape;
+        if (!repeated) {
+          for (auto [x, y] : variant.shape) variant.rows[y] |= uint64_t{1} << x;
+          for (int r = 0; r < variant.height; ++r) {
+            variant.halo[r] |= variant.rows[r] << 1;
+            variant.halo[r + 1] |= variant.rows[r] | (variant.rows[r] << 2);
+            variant.halo[r + 2] |= variant.rows[r] << 1;
+          }
+          ++result.count;
+        }
+        for (auto& [x, y] : current) { std::tie(x, y) = std::make_pair(-y, x); }
+      }
+      for (auto& [x, y] : current) { x = -x; }
+    }
+    // The slot left by a last repeated variant.
+    if (result.count < static_cast<int>(result.variants.size())) result.variants[result.count] = {};
+    return result;
+  }
+
+  struct piece_t {
+    piece_shape_t cells;
+    int type;
+    int max_count;
+    int used_count = 0;
+    // Expanded with the piece, at compile time for the catalog. Follows
+    // `cells` as they were at construction.
+    piece_variants_t variants = expand_variants(cells);
+
+    [[nodiscard]] constexpr const piece_variants_t& get_variants() const { return variants; }
+  };
+
+  // Piece from cells loaded at run time, empty when they can't make a piece:
+  // no cell, more than max_cells, a repeated cell or wider than max_extent.
+  [[nodiscard]] inline std::optional<piece_t> make_piece(std::span<const std::pair<int, int>> cells, int type, int max_count) {
+    if (cells.empty() || cells.size() > piece_shape_t::max_cells) return std::nullopt;
+    piece_shape_t shape;
+    for (auto cell : cells) shape.push_back(cell);
+    piece_t piece{shape, type, max_count};
+    if (piece.variants.size() == 0) return std::nullopt;
+    return piece;
+  }
+
+  // Map from unordered pairs of rooms to an int, open addressing over flat
+  // arrays.
+  class room_pair_map_t {
+    static constexpr uint64_t empty = ~uint64_t{0};
+    std::vector<uint64_t> keys = std::vector<uint64_t>(64, empty);
+    std::vector<int> values = std::vector<int>(64, 0);
+    size_t count = 0;
+
+  public:
+    // Value of {a, b}. When the pair isn't there `value` is stored and the
+    // bool is true.
+    std::pair<int, bool> emplace(int a, int b, int value) {
+      if (a > b) std::swap(a, b);
+      const uint64_t key = (static_cast<uint64_t>(a) << 32) | static_cast<uint32_t>(b);
+      if (2 * (count + 1) > keys.size()) grow();
+      const size_t k = slot(key);
+      if (keys[k] == key) return {values[k], false};
+      keys[k] = key;
+      values[k] = value;
+      ++count;
+      return {value, true};
+    }
+
+    // Adds {a, b}, false when it was already there.
+    bool insert(int a, int b) { return emplace(a, b, 0).second; }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+  private:
+    // Slot holding `key`, or the empty slot where it goes.
+    [[nodiscard]] size_t slot(uint64_t key) const {
+      const size_t mask = keys.size() - 1;
+      size_t k = (key * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+      while (keys[k] != key && keys[k] != empty) k = (k + 1) & mask;
+      return k;
+    }
+
+    void grow() {
+      std::vector<uint64_t> old_keys(keys.size() * 2, empty);
+      std::vector<int> old_values(values.size() * 2, 0);
+      old_keys.swap(keys);
+      old_values.swap(values);
+      for (size_t k = 0; k < old_keys.size(); ++k) {
+        if (old_keys[k] == empty) continue;
+        const size_t to = slot(old_keys[k]);
+        keys[to] = old_keys[k];
+        values[to] = old_values[k];
+      }
+    }
+  };
+
+  // Rooms of a tiling and the cell edges they share. Edges follow the
+  // segment_t convention: a horizontal edge lies on line y from column x, a
+  // vertical one on line x from row y. The shared edges of a pair of rooms
+  // come in the order a row-major scan of the south then east edge of every
+  // cell meets them. Doors are picked among them, at most one per pair.
+  class room_graph_t {
+  public:
+    struct edge_t {
+      int x, y;
+      bool is_horizontal;
+    };
+
+    // a < b, door is the index of the door among the edges of the pair, -1
+    // when the pair has none.
+    struct pair_t {
+      int a, b;
+      int door = -1;
+    };
+
+  private:
+    int rooms = 0;
+    std::vector<pair_t> pairs;
+    // Edges of pair k are edges[edge_start[k] .. edge_start[k + 1]).
+    std::vector<int> edge_start;
+    std::vector<edge_t> edges;
+    // Pairs of room r are neighbour_pairs[neighbour_start[r] .. neighbour_start[r + 1]).
+    std::vector<int> neighbour_start;
+    std::vector<int> neighbour_pairs;
+    // Door edges, (height + 1) x width horizontal and height x (width + 1)
+    // vertical, as in wall_grid_t.
+    bit_plane_t door_h;
+    bit_plane_t door_v;
+
+  public:
+    room_graph_t() = default;
+
+    // `grid` holds the room of every cell, -1 for the empty ones, and rooms
+    // are numbered from 0 to room_count - 1.
+    room_graph_t(const std::vector<std::vector<int>>& grid, int room_count)
+        : rooms(room_count), neighbour_start(room_count + 1, 0) {
+      const int height = static_cast<int>(grid.size());
+      const int width = height > 0 ? static_cast<int>(grid[0].size()) : 0;
+      door_h = bit_plane_t(height + 1, width);
+      door_v = bit_plane_t(height, width + 1);
+
+      room_pair_map_t index;
+      std::vector<std::pair<int, edge_t>> found;
+      auto add = [&](int a, int b, edge_t edge) {
+        if (a < 0 || b < 0 || a == b) return;
+        auto [k, added] = index.emplace(a, b, static_cast<int>(pairs.size()));
+        if (added) pairs.push_back({std::min(a, b), std::max(a, b)});
+        found.push_back({k, edge});
+      };
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          if (y + 1 < height) add(grid[y][x], grid[y + 1][x], {x, y + 1, true});
+          if (x + 1 < width) add(grid[y][x], grid[y][x + 1], {x + 1, y, false});
+        }
+      }
+
+      // Counting sort by pair, stable so every pair keeps the scan order.
+      edge_start.assign(pairs.size() + 1, 0);
+      for (const auto& [k, edge] : found) ++edge_start[k + 1];
+      for (size_t k = 0; k < pairs.size(); ++k) edge_start[k + 1] += edge_start[k];
+      edges.resize(found.size());
+      std::vector<int> next(edge_start.begin(), edge_start.end() - 1);
+      for (const auto& [k, edge] : found) edges[next[k]++] = edge;
+
+      for (const pair_t& pair : pairs) {
+        ++neighbour_start[pair.a + 1];
+        ++neighbour_start[pair.b + 1];
+      }
+      for (int r = 0; r < rooms; ++r) neighbour_start[r + 1] += neighbour_start[r];
+      neighbour_pairs.resize(2 * pairs.size());
+      next.assign(neighbour_start.begin(), neighbour_start.end() - 1);
+      for (int k = 0; k < static_cast<int>(pairs.size()); ++k) {
+        neighbour_pairs[next[pairs[k].a]++] = k;
+        neighbour_pairs[next[pairs[k].b]++] = k;
+      }
+    }
+
+    [[nodiscard]] int room_count() const { return rooms; }
+    [[nodiscard]] int pair_count() const { return static_cast<int>(pairs.size()); }
+    [[nodiscard]] const pair_t& pair(int k) const { return pairs[k]; }
+
+    [[nodiscard]] std::span<const edge_t> shared_edges(int k) const {
+      return {edges.data() + edge_start[k], edges.data() + edge_start[k + 1]};
+    }
+
+    // Pairs the room is in, the other room of pair k is other(k, room).
+    [[nodiscard]] std::span<const int> neighbours(int room) const {
+      return {neighbour_pairs.data() + neighbour_start[room], neighbour_pairs.data() + neighbour_start[room + 1]};
+    }
+
+    [[nodiscard]] int other(int k, int room) const { return pairs[k].a == room ? pairs[k].b : pairs[k].a; }
+
+    [[nodiscard]] bool is_door(const edge_t& edge) const {
+      return edge.is_horizontal ? door_h.test(edge.y, edge.x) : door_v.test(edge.y, edge.x);
+    }
+
+    [[nodiscard]] int door_count() const {
+      return static_cast<int>(door_h.count() + door_v.count());
+    }
+
+    // A door on the first shared edge of every pair, the doors pavage maps
+    // always had.
+    void choose_first_doors() {
+      for (pair_t& pair : pairs) pair.door = 0;
+      mark_doors();
+    }
+
+    // Doors of a random spanning tree of the rooms, so every room can be
+    // reached, then a door on each other pair with probability loop_fraction.
+    // The door of a pair is one of its shared edges at random.
+    void choose_doors(rng_t& rng, double loop_fraction) {
+      std::vector<int> order(pairs.size());
+      for (size_t k = 0; k < order.size(); ++k) order[k] = static_cast<int>(k);
+      rng.shuffle(order);
+
+      disjoint_set_t connected(rooms);
+      for (int k : order) {
+        pair_t& pair = pairs[k];
+        pair.door = -1;
+        if (connected.unite(pair.a, pair.b) || rng.unit() < loop_fraction) {
+          pair.door = rng.uniform(0, edge_start[k + 1] - edge_start[k] - 1);
+        }
+      }
+      mark_doors();
+    }
+
+    // Number of doors to go through from `from` to every room, -1 for the
+    // rooms that can't be reached.
+    [[nodiscard]] std::vector<int> door_distances(int from) const {
+      std::vector<int> distance(rooms, -1);
+      if (from < 0 || from >= rooms) return distance;
+      std::vector<int> queue{from};
+      distance[from] = 0;
+      for (size_t head = 0; head < queue.size(); ++head) {
+        const int room = queue[head];
+        for (int k : neighbours(room)) {
+          const int next = other(k, room);
+          if (pairs[k].door < 0 || distance[next] >= 0) continue;
+          distance[next] = distance[room] + 1;
+          queue.push_back(next);
+        }
+      }
+      return distance;
+    }
+
+    [[nodiscard]] bool is_connected() const {
+      const std::vector<int> distance = door_distances(0);
+      return std::find(distance.begin(), distance.end(), -1) == distance.end();
+    }
+
+  private:
+    void mark_doors() {
+      door_h = bit_plane_t(door_h.row_count(), door_h.col_count());
+      door_v = bit_plane_t(door_v.row_count(), door_v.col_count());
+      for (size_t k = 0; k < pairs.size(); ++k) {
+        if (pairs[k].door < 0) continue;
+        const edge_t& edge = edges[edge_start[k] + pairs[k].door];
+        if (edge.is_horizontal) door_h.set(edge.y, edge.x);
+        else door_v.set(edge.y, edge.x);
+      }
+    }
+  };
+
+  // How doors are placed between the rooms of a pavage map.
+  struct door_config_t {
+    // Doors of a random spanning tree of the rooms instead of a door between
+    // every pair of adjacent rooms.
+    bool spanning_tree = false;
+    // With spanning_tree, share of the other pairs of adjacent rooms that
+    // still get a door and make loops.
+    double loop_fraction = 0.1;
+  };
+
+  // Key of the rng stream the doors are drawn from.
+  inline constexpr uint64_t door_stream_key = 0xD0025;
+
+  struct collider_gen_t {
+    int width, height;
+    double cell_size;
+
+    struct segment_t {
+      int x, y;
+      bool is_horizontal;
+      bool is_door = false;
+      int length = 1;
+      
+      bool operator==(const segment_t& oth) const {
+        return x == oth.x && y == oth.y && is_horizontal == oth.is_horizontal;
+      }
+
+      bool operator<(const segment_t& oth) const {
+        if (is_horizontal != oth.is_horizontal) 
+          return is_horizontal < oth.is_horizontal;
+        if (is_horizontal) {
+          if (y != oth.y) return y < oth.y;
+          return x < oth.x;
+        } else {
+          if (x != oth.x) return x < oth.x;
+          return y < oth.y;
+        }
+      } 
+    };
+
+    // Reference extraction through ordered sets, kept to check
+    // sweep_wall_segments against.
+    std::vector<segment_t> extract_wall_segments(std::vector<std::vector<int>> grid) {
+      std::set<segment_t> segments;
+      std::vector<std::tuple<int, int, bool>> doors;
+      std::set<std::pair<int, int>> visited{};
+
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          int current = grid[y][x];
+
+          if (y == 0 || grid[y-1][x] != current) {
+            if (y == 0 || visited.contains({grid[y-1][x], current}) || grid[y-1][x] == -1 || current == -1)
+              segments.insert({x, y, true});
+            else {
+              segments.insert({x, y, true, true});
+              visited.insert({grid[y-1][x], current});
+              visited.insert({current, grid[y-1][x]});
+            }
+          }
+            
+
+          if (y == height - 1 || grid[y+1][x] != current) {
+            if (y == height - 1 || visited.contains({grid[y+1][x], current}) || grid[y+1][x] == -1 || current == -1)
+              segments.insert({x, y + 1, true});
+            else {
+              segments.insert({x, y + 1, true, true});
+              visited.insert({grid[y+1][x], current});
+              visited.insert({current, grid[y+1][x]});
+            }
+          }
+
+          if (x == 0 || grid[y][x-1] != current) {
+            if (x == 0 || visited.contains({grid[y][x-1], current}) || grid[y][x-1] == -1 || current == -1)
+              segments.insert({x, y, false});
+            else {
+              segments.insert({x, y, false, true});
+              visited.insert({grid[y][x-1], current});
+              visited.insert({current, grid[y][x-1]});
+            }
+          }
+
+          if (x == width - 1 || grid[y][x+1] != current) {
+            if (x == width - 1 || visited.contains({grid[y][x+1], current}) || grid[y][x+1] == -1 || current == -1)
+              segments.insert({x + 1, y, false});
+            else {
+              segments.insert({x + 1, y, false, true});
+              visited.insert({grid[y][x+1], current});
+              visited.insert({current,grid[y][x+1]});
+            }
+          }
+        }
+      }
+
+      return std::vector<segment_t>(segments.begin(), segments.end());
+    }
+
+    // Same segments as extract_wall_segments, in the same order, in two
+    // sweeps over the cells. The first one counts the vertical edges of every
+    // line so the second writes each edge straight to its slot: vertical lines
+    // first, then horizontal ones. A door goes on the first edge between two
+    // rooms met when checking the south then east edge of every cell in
+    // row-major order, which is the edge extract_wall_segments picks.
+    std::vector<segment_t> sweep_wall_segments(const std::vector<std::vector<int>>& grid) const {
+      room_pair_map_t linked;
+      return sweep(grid, [&linked](int a, int b, const room_graph_t::edge_t&) { return linked.insert(a, b); });
+    }
+
+    // Same with the doors chosen in `graph`.
+    std::vector<segment_t> sweep_wall_segments(const std::vector<std::vector<int>>& grid, const room_graph_t& graph) const {
+      return sweep(grid, [&graph](int, int, const room_graph_t::edge_t& edge) { return graph.is_door(edge); });
+    }
+
+  private:
+    // is_door(a, b, edge) is called on the edges between two rooms a and b
+    // in the scan order above.
+    template<typename door_fn>
+    std::vector<segment_t> sweep(const std::vector<std::vector<int>>& grid, door_fn is_door) const {
+      std::vector<int> column_start(width + 2, 0);
+      size_t horizontal_count = 2 * static_cast<size_t>(width);
+      for (int y = 0; y < height; ++y) {
+        const std::vector<int>& row = grid[y];
+        ++column_start[1];
+        ++column_start[width + 1];
+        for (int x = 1; x < width; ++x) column_start[x + 1] += row[x - 1] != row[x];
+        if (y > 0) {
+          const std::vector<int>& above = grid[y - 1];
+          for (int x = 0; x < width; ++x) horizontal_count += above[x] != row[x];
+        }
+      }
+      for (int x = 0; x <= width; ++x) column_start[x + 1] += column_start[x];
+
+      std::vector<segment_t> segments(column_start[width + 1] + horizontal_count, segment_t{0, 0, false});
+      size_t next_horizontal = column_start[width + 1];
+      std::vector<uint8_t> door_above(width, 0);
+      std::vector<uint8_t> door_below(width, 0);
+
+      for (int y = 0; y < height; ++y) {
+        const std::vector<int>& row = grid[y];
+        bool door_left = false;
+        for (int x = 0; x < width; ++x) {
+          const int current = row[x];
+          if (y == 0 || grid[y - 1][x] != current) segments[next_horizontal++] = {x, y, true, door_above[x] != 0};
+          if (x == 0 || row[x - 1] != current) segments[column_start[x]++] = {x, y, false, door_left};
+
+          door_below[x] = 0;
+          if (y + 1 < height) {
+            const int below = grid[y + 1][x];
+            door_below[x] = current >= 0 && below >= 0 && below != current && is_door(current, below, {x, y + 1, true});
+          }
+          door_left = false;
+          if (x + 1 < width) {
+            const int right = row[x + 1];
+            door_left = current >= 0 && right >= 0 && right != current && is_door(current, right, {x + 1, y, false});
+          }
+        }
+        segments[column_start[width]++] = {width, y, false};
+        door_above.swap(door_below);
+      }
+      for (int x = 0; x < width; ++x) segments[next_horizontal++] = {x, height, true};
+
+      return segments;
+    }
+
+  public:
+    // Merges runs of adjacent collinear walls into one segment. Segments come
+    // sorted line by line from sweep_wall_segments, so a run is a sequence
+    // of neighbours in the list. Doors are never merged.
+    std::vector<segment_t> merge_segments(const std::vector<segment_t>& segments) {
+      std::vector<segment_t> merged;
+      merged.reserve(segments.size());
+
+      for (const auto& seg : segments) {
+        if (!merged.empty() && !seg.is_door) {
+          segment_t& run = merged.back();
+          bool extends = !run.is_door && run.is_horizontal == seg.is_horizontal &&
+            (seg.is_horizontal
+              ? run.y == seg.y && run.x + run.length == seg.x
+              : run.x == seg.x && run.y + run.length == seg.y);
+          if (extends) {
+            run.length++;
+            continue;
+          }
+        }
+        merged.push_back(seg);
+      }
+
+      return merged;
+    }
+
+    collider_buffer_t generate_colliders(const std::vector<segment_t>& segments) {
+      collider_buffer_t colliders(cell_size);
+      colliders.reserve(segments.size());
+      for (const auto& seg : segments) {
+        colliders.push_back(seg.x, seg.y, seg.length,
+          seg.is_horizontal ? wall_orientation::H : wall_orientation::V, seg.is_door);
+      }
+      return colliders;
+    }
+  };
+
+  // Tiling algorithm of placement_t.
+  //  - scan: solve, every pass scans the whole grid in random order.
+  //  - frontier: solve_frontier, positions only come from the cells next to
+  //    the pieces already placed.
+  enum class solver_kind { scan, frontier };
+
+  // Cooperative stop of the solvers, checked between two placements. A solve
+  // stops once its token or the parent token is cancelled, once the deadline
+  // is passed or once give_up returns true. The pieces placed so far are kept
+  // and still make a valid tiling.
+  class cancel_token_t {
+    std::atomic<bool> cancelled{false};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    const cancel_token_t* parent = nullptr;
+
+  public:
+    // Set before the solve starts, only called by the thread running it.
+    std::function<bool()> give_up;
+
+    cancel_token_t() = default;
+    explicit cancel_token_t(std::chrono::steady_clock::time_point d, const cancel_token_t* p = nullptr)
+        : deadline(d), parent(p) {}
+
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+    [[nodiscard]] bool stop_requested() const {
+      return cancelled.load(std::memory_order_relaxed) || (parent && parent->stop_requested()) ||
+             (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline) ||
+             (give_up && give_up());
+    }
+  };
+
+  class placement_t {
+    int width, height, placement_id = 0;
+    std::vector<piece_t> pieces;
+    // Covered cells, one bit per cell, kept next to grid for the row masks.
+    bit_plane_t occupancy;
+    // Empty cells no piece can cover anymore, see mark_lost_regions. Only
+    // kept once track_lost_cells is on.
+    bool track_lost = false;
+    bit_plane_t lost;
+    int lost_cells = 0;
+    int smallest_left = INT_MAX;
+    std::vector<int> region;
+    bool bitboard = true;
+    std::vector<std::vector<int>> grid;
+    int placements = 0;
+    int covered = 0;
+    // Cells covered by a piece, room i holds the cells of placement i.
+    cell_sampler_t occupied;
+    // Piece type of every placement.
+    std::vector<int> room_types;
+    rng_t rng;
+    // Built by connect_rooms once the tiling is solved.
+    room_graph_t graph;
+
+    bool can_place(const variant_t& variant, int x, int y) {
+      for (auto [dx, dy] : variant) {
+        int nx = x + dx, ny = y + dy;
+        if (nx < 0 || nx >= width || ny < 0 || ny >= height || grid[ny][nx] != -1) { 
+          return false; 
+        }
+      }
+      return true;
+    }
+
+    // Cells [x, x + n) of row y as bits, n <= 64. Cells out of the grid are
+    // empty, x may be negative.
+    [[nodiscard]] uint64_t row_bits(int y, int x, int n) const {
+      if (y < 0 || y >= height || x >= width || x + n <= 0) return 0;
+      const uint64_t* words = occupancy.row(y);
+      uint64_t bits;
+      if (x < 0) {
+        bits = words[0] << -x;
+      } else {
+        const int w = x >> 6;
+        const int shift = x & 63;
+        bits = words[w] >> shift;
+        if (shift && w + 1 < occupancy.words_per_row()) bits |= words[w + 1] << (64 - shift);
+      }
+      return n == 64 ? bits : bits & ((uint64_t{1} << n) - 1);
+    }
+
+    // can_place with one AND per row of the variant.
+    [[nodiscard]] bool can_place_masks(const variant_t& mask, int x, int y) const {
+      if (x < 0 || y < 0 || x + mask.width > width || y + mask.height > height) return false;
+      uint64_t overlap = 0;
+      for (int r = 0; r < mask.height; ++r) overlap |= row_bits(y + r, x, mask.width) & mask.rows[r];
+      return overlap == 0;
+    }
+
+    // touches_existing through the halo of the variant, one AND per row.
+    [[nodiscard]] bool touches_masks(const variant_t& mask, int x, int y) const {
+      if (placements == 0) return true;
+      uint64_t contact = 0;
+      for (int r = 0; r < mask.height + 2; ++r) contact |= row_bits(y - 1 + r, x - 1, mask.width + 2) & mask.halo[r];
+      return contact != 0;
+    }
+
+    bool touches_existing(const variant_t& variant, int x, int y) {
+      if (placements == 0) { return true; }
+
+      for (auto [dx, dy] : variant) {
+        int cx = x + dx, cy = y + dy;
+        std::pair<int, int> neighbors[] = {{cx-1,cy}, {cx+1,cy}, {cx,cy-1}, {cx,cy+1}};
+        for (auto [nx, ny] : neighbors) {
+          if (nx >= 0 && nx < width && ny >= 0 && ny < height && grid[ny][nx] != -1) 
+            return true;
+        }
+      }
+      return false;
+    }
+
+    void place(int piece_idx, const variant_t& variant, int x, int y) {
+      occupied.begin_room();
+      room_types.push_back(pieces[piece_idx].type);
+      for (auto [dx, dy] : variant) {
+        grid[y + dy][x + dx] = placement_id;
+        occupancy.set(y + dy, x + dx);
+        occupied.add(y + dy, x + dx);
+        ++covered;
+      }
+      placement_id++;
+      placements++;
+      if (++pieces[piece_idx].used_count == pieces[piece_idx].max_count) update_smallest_left();
+      if (track_lost) mark_lost_regions(variant, x, y);
+    }
+
+    // Empty regions smaller than the smallest piece left are lost for good:
+    // cells only fill up and pieces only run out. Only the regions next to
+    // the piece just placed can have shrunk, their fill stops as soon as
+    // they reach that size so the work follows the size of the piece.
+    void mark_lost_regions(const variant_t& variant, int x, int y) {
+      const int smallest = smallest_left;
+      if (smallest == INT_MAX) return;
+
+      auto open = [&](int cx, int cy) {
+        return cx >= 0 && cx < width && cy >= 0 && cy < height && grid[cy][cx] == -1 && !lost.test(cy, cx);
+      };
+      for (auto [dx, dy] : variant) {
+        for (int dir = 0; dir < 4; ++dir) {
+          const int sx = x + dx + direction[dir].y, sy = y + dy + direction[dir].x;
+          // Most cells around the piece share the region filled just before.
+          if (!open(sx, sy) || std::find(region.begin(), region.end(), sy * width + sx) != region.end()) continue;
+
+          region.assign(1, sy * width + sx);
+          for (size_t k = 0; k < region.size() && static_cast<int>(region.size()) < smallest; ++k) {
+            const int cx = region[k] % width, cy = region[k] / width;
+            for (int d = 0; d < 4 && static_cast<int>(region.size()) < smallest; ++d) {
+              const int nx = cx + direction[d].y, ny = cy + direction[d].x;
+              if (open(nx, ny) && std::find(region.begin(), region.end(), ny * width + nx) == region.end()) {
+                region.push_back(ny * width + nx);
+              }
+            }
+          }
+          if (static_cast<int>(region.size()) >= smallest) continue;
+          for (int cell : region) lost.set(cell / width, cell % width);
+          lost_cells += static_cast<int>(region.size());
+        }
+      }
+      region.clear();
+    }
+
+    void update_smallest_left() {
+      smallest_left = INT_MAX;
+      for (const piece_t& piece : pieces) {
+        if (piece.used_count < piece.max_count) smallest_left = std::min(smallest_left, piece.cells.size());
+      }
+    }
+
+  public:
+    placement_t(int w, int h, std::vector<piece_t> p, uint64_t seed = 0) 
+      : width(w), height(h), pieces(p), grid(h, std::vector<int>(w, -1)), occupied(w), rng(seed) {
+      occupancy = bit_plane_t(h, w);
+      update_smallest_left();
+    }
+
+    // Keeps the empty cells no piece left can cover, for coverage_bound.
+    // Turn it on before the solve, it costs a few small fills per placement.
+    void track_lost_cells() {
+      track_lost = true;
+      lost = bit_plane_t(height, width);
+    }
+
+    // Tests with the row masks (default) or cell by cell, both place the
+    // same pieces.
+    void use_bitboard(bool enabled) { bitboard = enabled; }
+
+    // Whether variant v of piece p_idx can go at (x, y) in free cells,
+    // touching the pieces already placed.
+    [[nodiscard]] bool fits(int p_idx, int v, int x, int y) {
+      const variant_t& variant = pieces[p_idx].variants[v];
+      if (bitboard) return can_place_masks(variant, x, y) && touches_masks(variant, x, y);
+      return can_place(variant, x, y) && touches_existing(variant, x, y);
+    }
+
+    [[nodiscard]] int variant_count(int p_idx) const { return pieces[p_idx].variants.size(); }
+
+    [[nodiscard]] int get_width() const { return width; }
+    [[nodiscard]] int get_height() const { return height; }
+    [[nodiscard]] int covered_cells() const { return covered; }
+    [[nodiscard]] int placement_count() const { return placements; }
+
+    // Cells the tiling can still cover: the covered cells plus the empty
+    // cells that aren't lost, at most the cells of the pieces left. Without
+    // track_lost_cells no empty cell counts as lost. Only goes down as pieces
+    // are placed, before the solve it bounds every tiling of the pieces.
+    [[nodiscard]] int coverage_bound() const {
+      long long left = 0;
+      for (const piece_t& piece : pieces) {
+        left += static_cast<long long>(piece.max_count - piece.used_count) * static_cast<long long>(piece.cells.size());
+      }
+      const long long open = static_cast<long long>(width) * height - covered - lost_cells;
+      return covered + static_cast<int>(std::min(left, open));
+    }
+
+    [[nodiscard]] const cell_sampler_t& safe_cells() const { return occupied; }
+    [[nodiscard]] int room_type(int room) const { return room_types[room]; }
+
+    // Placement id of every cell, row-major, -1 for the empty cells.
+    [[nodiscard]] std::vector<int> room_map() const {
+      std::vector<int> rooms;
+      rooms.reserve(static_cast<size_t>(width) * height);
+      for (const auto& row : grid) rooms.insert(rooms.end(), row.begin(), row.end());
+      return rooms;
+    }
+
+    // Weight of each room (placement id) for retrieve_weighted_safe_point.
+    void set_room_weights(const std::vector<double>& weights) { occupied.set_room_weights(weights); }
+
+    // Random cell covered by a piece, as (row, column). An empty tiling has
+    // no such cell, any cell of the grid is returned then.
+    point_t retrieve_safe_cell() {
+      if (auto cell = occupied.sample(rng)) return *cell;
+      return {rng.uniform(0, height - 1), rng.uniform(0, width - 1)};
+    }
+
+    vector_t retrieve_safe_point(int segment_length) {
+      point_t cell = retrieve_safe_cell();
+      return random_point_in_cell(rng, cell.y, cell.x, segment_length);
+    }
+
+    vector_t retrieve_safe_point_in_room(int segment_length, int room) {
+      auto cell = occupied.sample_in_room(rng, room);
+      point_t c = cell ? *cell : retrieve_safe_cell();
+      return random_point_in_cell(rng, c.y, c.x, segment_length);
+    }
+
+    vector_t retrieve_weighted_safe_point(int segment_length) {
+      auto cell = occupied.sample_weighted(rng);
+      point_t c = cell ? *cell : retrieve_safe_cell();
+      return random_point_in_cell(rng, c.y, c.x, segment_length);
+    }
+
+    spawn_points_t retrieve_spawn_points(int segment_length, int min_distance, int max_distance) {
+      wall_grid_t walls = retrieve_wall_grid();
+      return place_spawn_points(walls, rng, retrieve_safe_cell(), segment_length, min_distance, max_distance);
+    }
+
+    // Returns whether the search ran to its end, false when `cancel` stopped
+    // it before it ran out of placements.
+    bool solve(const cancel_token_t* cancel = nullptr) {
+      bool placed = true;
+      while (placed && !(cancel && cancel->stop_requested())) {
+        placed = false;
+
+        std::vector<int> order(pieces.size());
+        for (size_t i = 0; i < order.size(); ++i) { order[i] = static_cast<int>(i); }
+        rng.shuffle(order);
+        
+        for (int p_idx : order) {
+          if (pieces[p_idx].used_count >= pieces[p_idx].max_count) { continue; }
+
+          shape_t positions;
+          for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+              positions.push_back({x, y});
+            }
+          }
+          rng.shuffle(positions);
+
+          // Shuffled as indices, the same draws as shuffling the variants.
+          std::vector<int> variants(pieces[p_idx].variants.size());
+          for (size_t v = 0; v < variants.size(); ++v) variants[v] = static_cast<int>(v);
+          rng.shuffle(variants);
+
+          for (auto [x, y] : positions) {
+            if (placed) break;
+            for (int v : variants) {
+              if (fits(p_idx, v, x, y)) {
+                place(p_idx, pieces[p_idx].variants[v], x, y);
+                placed = true;
+                break;
+              }
+            }
+          }
+          if (placed) break;
+        }
+      }
+      return !placed;
+    }
+
+    // Builds the room graph of the tiling and picks its doors, the walls and
+    // the wall grid follow them. Without it every pair of adjacent rooms gets
+    // a door on the first edge they share.
+    void connect_rooms(const door_config_t& doors, rng_t& door_rng) {
+      graph = room_graph_t(grid, placement_id);
+      if (doors.spanning_tree) graph.choose_doors(door_rng, doors.loop_fraction);
+      else graph.choose_first_doors();
+    }
+
+    [[nodiscard]] const room_graph_t& room_graph() const { return graph; }
+
+    // Same rules as solve, each piece after the first touches the pieces
+    // already placed, but positions are only drawn from the frontier: the
+    // empty cells next to a placed piece. A piece touching the others covers
+    // one of them, so anchoring every cell of every variant on the frontier
+    // cells finds any placement solve could make. The frontier is updated
+    // with each piece, the work per placement follows its size instead of the
+    // area of the map. Cells only fill up, so a piece that fit nowhere can
+    // only fit later over a cell added to the frontier since, the others are
+    // not tried again. The tiling differs from solve for the same seed.
+    bool solve_frontier(const cancel_token_t* cancel = nullptr) {
+      if (width <= 0 || height <= 0) return true;
+
+      // Sparse set of frontier cells, slot[cell] is their index in frontier.
+      // added_at numbers the cells in the order they joined the frontier.
+      std::vector<int> frontier;
+      std::vector<int> slot(static_cast<size_t>(width) * height, -1);
+      std::vector<int> added_at(static_cast<size_t>(width) * height, 0);
+      int additions = 0;
+      auto add = [&](int x, int y) {
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        const int cell = y * width + x;
+        if (grid[y][x] != -1 || slot[cell] >= 0) return;
+        slot[cell] = static_cast<int>(frontier.size());
+        added_at[cell] = additions++;
+        frontier.push_back(cell);
+      };
+      auto remove = [&](int cell) {
+        const int k = slot[cell];
+        if (k < 0) return;
+        slot[frontier.back()] = k;
+        frontier[k] = frontier.back();
+        frontier.pop_back();
+        slot[cell] = -1;
+      };
+
+      if (placements == 0) {
+        // The first piece goes over a random cell.
+        add(rng.uniform(0, width - 1), rng.uniform(0, height - 1));
+      } else {
+        for (int y = 0; y < height; ++y) {
+          for (int x = 0; x < width; ++x) {
+            if (grid[y][x] == -1) continue;
+            add(x - 1, y);
+            add(x + 1, y);
+            add(x, y - 1);
+            add(x, y + 1);
+          }
+        }
+      }
+
+      // Places piece p_idx over one of the frontier cells if it fits anywhere.
+      // failed_at[p] is the value of additions when piece p last fit nowhere.
+      std::vector<int> failed_at(pieces.size(), 0);
+      std::vector<int> candidates;
+      std::vector<int> variant_order;
+      auto try_piece = [&](int p_idx) {
+        candidates.clear();
+        for (int cell : frontier) {
+          if (added_at[cell] >= failed_at[p_idx]) candidates.push_back(cell);
+        }
+        if (candidates.empty()) return false;
+        rng.shuffle(candidates);
+        variant_order.resize(pieces[p_idx].variants.size());
+        for (size_t v = 0; v < variant_order.size(); ++v) variant_order[v] = static_cast<int>(v);
+        rng.shuffle(variant_order);
+
+        for (int cell : candidates) {
+          const int fx = cell % width, fy = cell / width;
+          for (int v : variant_order) {
+            const variant_t& variant = pieces[p_idx].variants[v];
+            for (auto [dx, dy] : variant) {
+              const int x = fx - dx, y = fy - dy;
+              if (!(bitboard ? can_place_masks(variant, x, y) : can_place(variant, x, y))) continue;
+              place(p_idx, variant, x, y);
+              for (auto [cx, cy] : variant) remove((y + cy) * width + x + cx);
+              for (auto [cx, cy] : variant) {
+                add(x + cx - 1, y + cy);
+                add(x + cx + 1, y + cy);
+                add(x + cx, y + cy - 1);
+                add(x + cx, y + cy + 1);
+              }
+              return true;
+            }
+          }
+        }
+        failed_at[p_idx] = additions;
+        return false;
+      };
+
+      std::vector<int> order(pieces.size());
+      for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+      bool placed = true;
+      while (placed && !frontier.empty() && !(cancel && cancel->stop_requested())) {
+        placed = false;
+        rng.shuffle(order);
+        for (int p_idx : order) {
+          if (pieces[p_idx].used_count >= pieces[p_idx].max_count) continue;
+          if (try_piece(p_idx)) {
+            placed = true;
+            break;
+          }
+        }
+      }
+      return !placed || frontier.empty();
+    }
+
+    bool solve(solver_kind solver, const cancel_token_t* cancel = nullptr) {
+      if (solver == solver_kind::frontier) return solve_frontier(cancel);
+      return solve(cancel);
+    }
+
+    collider_buffer_t retrieve_walls(double cell_size, bool merge_walls = false) {
+      collider_gen_t collider_gen{width, height, cell_size};
+      auto segments = segments_of(collider_gen);
+      if (merge_walls) segments = collider_gen.merge_segments(segments);
+      return collider_gen.generate_colliders(segments);
+    }
+
+    // Walls of the tiling as a wall grid, doors are open. Unlike the colliders
+    // every edge between two cells of the same room is open.
+    wall_grid_t retrieve_wall_grid() {
+      collider_gen_t collider_gen{width, height, 1.0};
+      wall_grid_t walls(width, height);
+      for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+          if (i + 1 < height) walls.remove_wall(i, j, 1);
+          if (j + 1 < width) walls.remove_wall(i, j, 2);
+        }
+      }
+
+      for (const auto& seg : segments_of(collider_gen)) {
+        if (seg.is_door) continue;
+        if (seg.is_horizontal) {
+          if (seg.y < height) walls.set_wall(seg.y, seg.x, 0, true);
+          else walls.set_wall(seg.y - 1, seg.x, 1, true);
+        } else {
+          if (seg.x < width) walls.set_wall(seg.y, seg.x, 3, true);
+          else walls.set_wall(seg.y, seg.x - 1, 2, true);
+        }
+      }
+      return walls;
+    }
+
+    // Wall segments with the doors of the room graph once it's built.
+    std::vector<collider_gen_t::segment_t> segments_of(const collider_gen_t& collider_gen) const {
+      if (graph.room_count() != placement_id) return collider_gen.sweep_wall_segments(grid);
+      return collider_gen.sweep_wall_segments(grid, graph);
+    }
+
+    void display() {
+      for (auto& row : grid) {
+        for (int cell : row) {
+          if (cell == -1) {
+            std::cout << ". ";
+          } else {
+            std::cout << (char)('A' + cell % 26) << ' ';
+          }
+        }
+        std::cout << "\n";
+      }
+    }
+  };
+
+  // Key of the rng streams of the portfolio solves after the first.
+  inline constexpr uint64_t portfolio_stream_key = 0x9F0000;
+
+  // Several independent solves of the same map, the best tiling is kept.
+  struct portfolio_config_t {
+    int solves = 8;
+    // Worker threads, 0 uses one per core.
+    int threads = 0;
+    // Time given to the whole portfolio, 0 for no limit. Solves still running
+    // then stop where they are and their partial tiling competes too.
+    std::chrono::milliseconds budget{0};
+    solver_kind solver = solver_kind::frontier;
+    // Score of a tiling, the highest wins. Empty scores the covered cells.
+    std::function<double(const placement_t&)> objective;
+    // Score no tiling can beat. Once a solve reaches it the solves after it
+    // are cancelled. Only needed with an objective, the coverage objective
+    // uses placement_t::coverage_bound.
+    double best_possible = std::numeric_limits<double>::infinity();
+    // Highest score a solve can still reach from its partial tiling, a solve
+    // whose bound falls below the best score so far is cancelled. Only needed
+    // with an objective, the coverage objective uses
+    // placement_t::coverage_bound. Without it losing solves run to the end.
+    std::function<double(const placement_t&)> bound;
+  };
+
+  struct portfolio_result_t {
+    placement_t placement;
+    // Index of the winning solve, solve 0 uses the map seed itself.
+    int solve;
+    double score;
+    // Solves whose search ran to its end, the others were stopped by the
+    // budget or given up as losing.
+    int completed;
+  };
+
+  // Runs config.solves solves of a width x height map across worker
+  // threads and keeps the tiling with the best score. Solve 0 is seeded with
+  // `seed`, so a portfolio of one solve gives the map of `seed`, the others
+  // with their own rng stream. Ties go to the lowest solve, so without a
+  // budget the result only depends on the seed and the number of solves,
+  // never on the threads.
+  inline portfolio_result_t solve_portfolio(int width, int height, const std::vector<piece_t>& pieces, uint64_t seed,
+                                            const portfolio_config_t& config, const cancel_token_t* cancel = nullptr) {
+    const int solves = std::max(config.solves, 1);
+    auto score = [&config](const placement_t& placement) {
+      return config.objective ? config.objective(placement) : static_cast<double>(placement.covered_cells());
+    };
+
+    const auto deadline = config.budget.count() > 0 ? std::chrono::steady_clock::now() + config.budget
+                                                    : std::chrono::steady_clock::time_point::max();
+    const cancel_token_t portfolio(deadline, cancel);
+    // One token per solve, a solve reaching best_possible cancels the ones
+    // after it. The ones before it may still tie and win.
+    std::deque<cancel_token_t> tokens;
+    for (int k = 0; k < solves; ++k) tokens.emplace_back(std::chrono::steady_clock::time_point::max(), &portfolio);
+    std::vector<std::optional<placement_t>> results(solves);
+    std::vector<double> scores(solves, -std::numeric_limits<double>::infinity());
+    std::vector<uint8_t> completed(solves, 0);
+    std::atomic<int> next_solve{0};
+    const double best_possible = config.objective ? config.best_possible : placement_t(width, height, pieces).coverage_bound();
+
+    // Best score reached so far. Covered cells only grow, so the coverage of
+    // a running solve counts too, a custom objective only counts once its
+    // solve is over. A solve is given up once its bound is below it: it can't
+    // win nor tie, so the winner doesn't depend on when that happens.
+    std::atomic<double> best_score{-std::numeric_limits<double>::infinity()};
+    auto raise_best = [&best_score](double value) {
+      double current = best_score.load(std::memory_order_relaxed);
+      while (value > current && !best_score.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    };
+
+    auto work = [&] {
+      for (int k = next_solve++; k < solves; k = next_solve++) {
+        // Solve 0 always runs, there is a tiling to return even when
+        // cancelled before anything started.
+        if (k > 0 && tokens[k].stop_requested()) continue;
+
+        const uint64_t solve_seed = k == 0 ? seed : rng_t::stream(seed, portfolio_stream_key + k).next();
+        placement_t placement(width, height, pieces, solve_seed);
+        if (!config.objective) {
+          placement.track_lost_cells();
+          tokens[k].give_up = [&] {
+            raise_best(placement.covered_cells());
+            return placement.coverage_bound() < best_score.load(std::memory_order_relaxed);
+          };
+        } else if (config.bound) {
+          tokens[k].give_up = [&] { return config.bound(placement) < best_score.load(std::memory_order_relaxed); };
+        }
+        completed[k] = placement.solve(config.solver, &tokens[k]);
+        tokens[k].give_up = nullptr;
+        scores[k] = score(placement);
+        raise_best(scores[k]);
+
+        results[k] = std::move(placement);
+        if (scores[k] >= best_possible) {
+          for (int later = k + 1; later < solves; ++later) tokens[later].cancel();
+        }
+      }
+    };
+
+    int workers = config.threads > 0 ? config.threads : static_cast<int>(std::thread::hardware_concurrency());
+    workers = std::clamp(workers, 1, solves);
+    std::vector<std::thread> pool;
+    for (int k = 1; k < workers; ++k) pool.emplace_back(work);
+    work();
+    for (auto& worker : pool) worker.join();
+
+    int winner = 0;
+    for (int k = 1; k < solves; ++k) {
+      if (results[k] && scores[k] > scores[winner]) winner = k;
+    }
+    const int finished = static_cast<int>(std::count(completed.begin(), completed.end(), 1));
+    return {std::move(*results[winner]), winner, scores[winner], finished};
+  }
+
+  struct map_t {
+    int width, height, cell_size;
+    uint64_t seed;
+    collider_buffer_t walls;
+    placement_t placer;
+
+    map_t(int w, int h, int segment_length, std::vector<piece_t> pieces, uint64_t seed = 0, bool merge_walls = false,
+          const door_config_t& doors = {}, solver_kind solver = solver_kind::scan)
+      : map_t(solved(w, h, std::move(pieces), seed, solver), segment_length, seed, merge_walls, doors) {}
+
+    // Map over a tiling solved beforehand, e.g. by solve_portfolio. The doors
+    // and the balls are drawn from `seed`.
+    map_t(placement_t solved_placer, int segment_length, uint64_t seed, bool merge_walls = false,
+          const door_config_t& doors = {})
+      : width(solved_placer.get_width()), height(solved_placer.get_height()), cell_size(segment_length), seed(seed),
+        placer(std::move(solved_placer)) {
+      rng_t door_rng = rng_t::stream(seed, door_stream_key);
+      placer.connect_rooms(doors, door_rng);
+      walls = placer.retrieve_walls(cell_size, merge_walls);
+    }
+
+    [[nodiscard]] static placement_t solved(int w, int h, std::vector<piece_t> pieces, uint64_t seed, solver_kind solver) {
+      placement_t placement(w, h, std::move(pieces), seed);
+      placement.solve(solver);
+      return placement;
+    }
+
+    vector_t retrieve_safe_point() { return placer.retrieve_safe_point(cell_size); }
+    vector_t retrieve_safe_point_in_room(int room) { return placer.retrieve_safe_point_in_room(cell_size, room); }
+    vector_t retrieve_weighted_safe_point() { return placer.retrieve_weighted_safe_point(cell_size); }
+    void set_room_weights(const std::vector<double>& weights) { placer.set_room_weights(weights); }
+    [[nodiscard]] const cell_sampler_t& safe_cells() const { return placer.safe_cells(); }
+
+    // Poisson-disk ball positions in the rooms, `density_by_type[t]` weighs
+    // the rooms made of pieces of type t (1 when missing).
+    std::vector<vector_t> retrieve_balls(const ball_placement_config_t& config,
+                                         const std::vector<double>& density_by_type = {}) {
+      std::vector<double> density(placer.safe_cells().room_count(), 1.0);
+      for (int room = 0; room < static_cast<int>(density.size()); ++room) {
+        int type = placer.room_type(room);
+        if (type >= 0 && type < static_cast<int>(density_by_type.size())) density[room] = density_by_type[type];
+      }
+
+      wall_grid_t grid = placer.retrieve_wall_grid();
+      rng_t ball_rng = rng_t::stream(seed, ball_stream_key);
+      ball_placer_t balls(grid, placer.room_map(), cell_size);
+      return balls.place(config, ball_rng, density);
+    }
+
+    // Floor rectangles over the cells covered by a piece, the empty cells
+    // have no floor.
+    [[nodiscard]] std::vector<floor_rect_t> retrieve_floor() const {
+      std::vector<int> materials = placer.room_map();
+      for (int& cell : materials) cell = cell < 0 ? -1 : 0;
+      return merge_floor_cells(materials, width, height);
+    }
+
+    spawn_points_t retrieve_spawn_points(int min_distance, int max_distance) {
+      return placer.retrieve_spawn_points(cell_size, min_distance, max_distance);
+    }
+    [[nodiscard]] const collider_buffer_t& get_walls() const { return walls; }
+    wall_grid_t retrieve_wall_grid() { return placer.retrieve_wall_grid(); }
+    [[nodiscard]] std::vector<int> room_map() const { return placer.room_map(); }
+    // Rooms, the edges they share and their doors, room i is placement i.
+    [[nodiscard]] const room_graph_t& room_graph() const { return placer.room_graph(); }
+
+    [[nodiscard]] std::string latex() const {
+      std::ostringstream oss;
+      oss << std::fixed << std::setprecision(2);
+
+      oss << "\\documentclass[margin=5pt]{standalone}\n"
+          << "\\usepackage{tikz}\n"
+          << "\\begin{document}\n"
+          << "\\begin{tikzpicture}[scale=0.5]\n";
+      for (size_t k = 0; k < walls.size(); ++k) {
+        const vector_t c = walls.centroid(k);
+        double half = walls.length(k) / 2.0;
+
+        std::string color = walls.is_door(k) ? "red" : "black";
+
+        if (!walls.is_vertical(k)) {
+          oss << "\\draw[" << color << "] (" << c.X - half << "," << c.Y << ") -- ("
+              << c.X + half << "," << c.Y << ");\n";
+        } else {
+          oss << "\\draw[" << color << "] (" << c.X << "," << c.Y - half << ") -- ("
+              << c.X << "," << c.Y + half << ");\n";
+        }
+      }
+      oss << "\\end{tikzpicture}\n"
+          << "\\end{document}\n";
+
+      return oss.str();
+    }
+  };
+  
+  // Built-in pieces, expanded at compile time.
+  inline constexpr std::array<piece_t, 8> catalog = {{
+        { 
+          { 
+            {0,5},
+            {0,4},
+            {0,3},
+            {0,2},
+            {0,1}, {1,1}, {2,1}, {3,1}, {4,1}, {5,1},
+            {0,0}, {1,0}, {2,0}, {3,0}, {4,0}, {5,0},
+          },1, 10 
+        },
+        {
+          {
+            {0,5}, {1,5},               {4,5}, {5,5}, 
+            {0,4}, {1,4},               {4,4}, {5,4}, 
+            {0,3}, {1,3}, {2,3}, {3,3}, {4,3}, {5,3},
+            {0,2}, {1,2}, {2,2}, {3,2}, {4,2}, {5,2},
+            {0,1}, {1,1},               {4,1}, {5,1}, 
+            {0,0}, {1,0},               {4,0}, {5,0}, 
+          }, 2, 10
+        },
+        {
+            {
+              {2,3}, {3,3}, {4,3}, {5,3},
+              {2,2}, {3,2}, {4,2}, {5,2},
+    {0,1}, {1,1}, {2,1}, {3,1},
+    {0,0}, {1,0}, {2,0}, {3,0},
+    }, 3, 10
+    },
+    {
+      {
+        {0,2}, {1,2}, {2,2},
+        {0,1}, {1,1}, {2,1},
+        {0,0}, {1,0}, {2,0}
+      }, 1, 4
+    },
+    {
+        {
+          {0,2},        {2,2},
+          {0,1}, {1,1}, {2,1},
+          {0,0},        {2,0}
+        }, 2, 10
+      },
+      {
+        {
+          {0, 0}
+        }, 3, 10 
+      },
+      {
+        {
+          {0,0}, {1,0}, {2,0}
+        }, 4, 10
+      },
+      {
+        {
+          {0,2},
+          {0,1},
+          {0,0}, {1,0}, {2,0}
+        }, 5, 10
+      }
+  }};
+  static_assert(std::ranges::all_of(catalog, [](const piece_t& piece) { return piece.variants.size() > 0; }),
+                "every piece of the catalog fits in a piece_shape_t");
+
+  // The catalog as the piece list of a map, copied without expanding it again.
+  inline std::vector<piece_t> pieces(catalog.begin(), catalog.end());
+};
@@ -0,0 +1,35 @@
+﻿#include "PavagePieceCatalog.h"
+
+#include "NinetyNinePinkBalls.h"
+
+#include <optional>
+#include <utility>
+
+#include "Pavage.h"
+
+std::vector<pavage::piece_t> UPavagePieceCatalog::ToPieces() const
+{
+	std::vector<pavage::piece_t> pieces;
+	pieces.reserve(Pieces.Num());
+	std::vector<std::pair<int, int>> cells;
+	for (int32 index = 0; index < Pieces.Num(); ++index)
+	{
+		const FPavagePiece& Piece = Pieces[index];
+		cells.clear();
+		for (const FIntPoint& Cell : Piece.Cells)
+		{
+			cells.push_back({Cell.X, Cell.Y});
+		}
+		
+		if (std::optional<pavage::piece_t> piece = pavage::make_piece(cells, Piece.Type, Piece.MaxCount))
+		{
+			pieces.push_back(*piece);
+		}
+		else
+		{
+			UE_LOG(LogNinetyNinePinkBalls, Warning, TEXT("%s: piece %d skipped, it needs 1 to %d distinct cells within %d by %d"),
+				*GetName(), index, pavage::piece_shape_t::max_cells, pavage::piece_shape_t::max_extent, pavage::piece_shape_t::max_extent);
+		}
+	}
+	return pieces;
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+
+// Generated
+#include "PavagePieceCatalog.generated.h"
+
+namespace pavage { struct piece_t; }
+
+USTRUCT()
+struct FPavagePiece
+{
+	GENERATED_BODY()
+	
+	// Cells of the piece, anywhere on the grid, within an 8 by 8 box once rotated
+	UPROPERTY(EditAnywhere)
+	TArray<FIntPoint> Cells;
+	
+	// Rooms made of this piece use the ball density of their type
+	UPROPERTY(EditAnywhere, meta=(ClampMin="0"))
+	int32 Type = 1;
+	
+	// Times the piece can be placed on a map
+	UPROPERTY(EditAnywhere, meta=(ClampMin="0"))
+	int32 MaxCount = 10;
+};
+
+// Pieces the pavage tiles the map with, in place of the built-in ones
+UCLASS()
+class NINETYNINEPINKBALLS_API UPavagePieceCatalog : public UDataAsset
+{
+	GENERATED_BODY()
+	
+public:
+	UPROPERTY(EditDefaultsOnly, Category="Pavage")
+	TArray<FPavagePiece> Pieces;
+	
+	// Pieces with their variants expanded, the ones that can't be placed are skipped with a warning
+	std::vector<pavage::piece_t> ToPieces() const;
+};
@@ -0,0 +1,93 @@
+﻿#pragma once
+
+#include <algorithm>
+
+#include "MapTypes.h"
+
+struct cell_t {
+  bool n = true, s = true, e = true, w = true;
+
+  [[nodiscard]] bool is_wall(int pos) const {
+    switch (pos) {
+      case 0: return n;
+      case 1: return s;
+      case 2: return e;
+      case 3: return w;
+      default: return false;
+    }
+  }
+
+  [[nodiscard]] bool has_single_wall() const {
+    return n + s + e + w == 1;
+  }
+};
+
+// Rectangle of cells, x is the column and y the row of its top left cell.
+struct grid_rect_t {
+  int x, y, width, height;
+
+  // Part of the rectangle inside a grid of w x h cells, empty when it's
+  // outside.
+  [[nodiscard]] grid_rect_t clamped(int w, int h) const {
+    const int x0 = std::max(x, 0), y0 = std::max(y, 0);
+    return {x0, y0, std::max(std::min(x + width, w) - x0, 0), std::max(std::min(y + height, h) - y0, 0)};
+  }
+};
+
+// Maze walls stored as one bit per cell edge. `h` holds the horizontal edges
+// (height + 1 rows of width edges) and `v` the vertical ones (height rows of
+// width + 1 edges), so an interior wall only exists once. Cells are addressed
+// as (row, column) and directions follow `direction`: n, s, e, w.
+class wall_grid_t {
+  int width = 0;
+  int height = 0;
+  bit_plane_t h;
+  bit_plane_t v;
+
+public:
+  wall_grid_t() = default;
+
+  wall_grid_t(int w, int hgt)
+      : width(w), height(hgt), h(hgt + 1, w, true), v(hgt, w + 1, true) {}
+
+  [[nodiscard]] int get_width() const { return width; }
+  [[nodiscard]] int get_height() const { return height; }
+  [[nodiscard]] const bit_plane_t& horizontal() const { return h; }
+  [[nodiscard]] const bit_plane_t& vertical() const { return v; }
+
+  [[nodiscard]] bool in_bounds(int i, int j) const {
+    return i >= 0 && i < height && j >= 0 && j < width;
+  }
+
+  [[nodiscard]] bool is_wall(int i, int j, int dir) const {
+    switch (dir) {
+      case 0: return h.test(i, j);
+      case 1: return h.test(i + 1, j);
+      case 2: return v.test(i, j + 1);
+      case 3: return v.test(i, j);
+      default: return false;
+    }
+  }
+
+  void set_wall(int i, int j, int dir, bool wall) {
+    switch (dir) {
+      case 0: h.assign(i, j, wall); break;
+      case 1: h.assign(i + 1, j, wall); break;
+      case 2: v.assign(i, j + 1, wall); break;
+      case 3: v.assign(i, j, wall); break;
+      default: break;
+    }
+  }
+
+  void remove_wall(int i, int j, int dir) { set_wall(i, j, dir, false); }
+
+  [[nodiscard]] cell_t cell(int i, int j) const {
+    return { h.test(i, j), h.test(i + 1, j), v.test(i, j + 1), v.test(i, j) };
+  }
+
+  [[nodiscard]] int wall_count(int i, int j) const {
+    return h.test(i, j) + h.test(i + 1, j) + v.test(i, j + 1) + v.test(i, j);
+  }
+
+  [[nodiscard]] size_t memory_size() const { return h.memory_size() + v.memory_size(); }
+};
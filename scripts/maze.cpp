@@ -1,354 +1,554 @@
-#include <vector>
-#include <array>
-#include <unordered_set>
-#include <random>
-#include <memory>
-#include <sstream>
-#include <iomanip>
-#include <string>
-#include <numbers>
+#define MAPGEN_STANDALONE
+#include "../NinetyNinePinkBalls/Source/NinetyNinePinkBalls/MapGeneration/Maze.h"
+#include "../NinetyNinePinkBalls/Source/NinetyNinePinkBalls/MapGeneration/MapChunks.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
 
-template<typename T>
-struct TVector{ T X; T Y; T Z; };
-
-using FVector = TVector<double>;
-
-using vector_t = FVector;
-
-
-struct point_t {
-  int x, y;
+namespace {
+  struct algorithm_name_t {
+    const char* name;
+    maze_algorithm algorithm;
+  };
 
-  bool operator==(const point_t& oth) const {
-    return x == oth.x && y == oth.y;
+  constexpr std::array<algorithm_name_t, 4> algorithms = {{
+    {"prim", maze_algorithm::prim},
+    {"kruskal", maze_algorithm::kruskal},
+    {"wilson", maze_algorithm::wilson},
+    {"backtracker", maze_algorithm::backtracker},
+  }};
+
+  // Golden entries name tiled maps "<algorithm>@<tile size>".
+  std::pair<std::string, int> split_tile(const std::string& name) {
+    size_t at = name.find('@');
+    if (at == std::string::npos) return {name, 0};
+    return {name.substr(0, at), std::atoi(name.c_str() + at + 1)};
   }
-};
 
-namespace std {
-  template<>
-  struct hash<point_t> {
-    size_t operator()(const point_t& p) const {
-      return std::hash<int>()(p.x) ^ (std::hash<int>()(p.y) << 1);
+  std::optional<maze_algorithm> parse_algorithm(const char* name) {
+    for (const auto& a : algorithms) {
+      if (std::strcmp(a.name, name) == 0) return a.algorithm;
     }
-  };
-}
-
-inline constexpr std::array<point_t, 4> direction = {{
-  {-1, 0}, {1, 0}, {0, 1}, {0, -1}
-}};
+    return std::nullopt;
+  }
 
-struct cell_t {
-  bool n = true, s = true, e = true, w = true;
+  // Share of cells by number of walls, gives an idea of the texture of the
+  // maze: lots of dead ends for prim/kruskal, long corridors for backtracker.
+  struct shape_stats_t {
+    double dead_ends = 0, corridors = 0, turns = 0, junctions = 0;
+  };
 
-  [[nodiscard]] bool is_wall(int pos) const {
-    switch (pos) {
-      case 0: return n;
-      case 1: return s;
-      case 2: return e;
-      case 3: return w;
-      default: return false;
+  shape_stats_t shape_stats(const wall_grid_t& grid) {
+    shape_stats_t stats;
+    for (int i = 0; i < grid.get_height(); ++i) {
+      for (int j = 0; j < grid.get_width(); ++j) {
+        cell_t cell = grid.cell(i, j);
+        switch (grid.wall_count(i, j)) {
+          case 3: stats.dead_ends++; break;
+          case 2:
+            if (cell.n == cell.s) stats.corridors++;
+            else stats.turns++;
+            break;
+          default: stats.junctions++; break;
+        }
+      }
     }
+    double cells = static_cast<double>(grid.get_width()) * grid.get_height();
+    stats.dead_ends /= cells / 100;
+    stats.corridors /= cells / 100;
+    stats.turns /= cells / 100;
+    stats.junctions /= cells / 100;
+    return stats;
   }
 
-  [[nodiscard]] bool has_single_wall() const {
-    int count = 0;
-    if (n) count++;
-    if (s) count++;
-    if (e) count++;
-    if (w) count++;
-    return count == 1;
+  // Threshold 64 disables the pruning pass (a 4x4 window has at most 64
+  // walls) so the numbers only reflect the spanning tree.
+  int bench(const std::vector<int>& sizes) {
+    std::printf("%-12s %6s %10s %9s %9s %9s %9s %9s\n",
+      "algorithm", "size", "time (ms)", "mem (KB)", "dead end%", "corridor%", "turn%", "junction%");
+
+    for (int size : sizes) {
+      for (const auto& a : algorithms) {
+        auto begin = std::chrono::steady_clock::now();
+        map_t m{{size, size, 10, 64, a.algorithm}};
+        auto end = std::chrono::steady_clock::now();
+
+        auto stats = shape_stats(m.get_grid());
+        std::printf("%-12s %6d %10.1f %9zu %9.1f %9.1f %9.1f %9.1f\n",
+          a.name, size, std::chrono::duration<double, std::milli>(end - begin).count(),
+          m.get_grid().memory_size() / 1024,
+          stats.dead_ends, stats.corridors, stats.turns, stats.junctions);
+      }
+    }
+    return 0;
   }
-};
 
-enum class wall_orientation { H, V };
-
-struct collider_t {
-  vector_t centroid;
-  wall_orientation orientation;
-  double length;
-
-  collider_t(const vector_t& c, wall_orientation o, double l)
-      : centroid(c), orientation(o), length(l) {}
-
-  [[nodiscard]] std::array<vector_t, 2> get_endpoints() const {
-    if (orientation == wall_orientation::H) {
-      return {{
-        {centroid.X - length / 2, centroid.Y, centroid.Z},
-        {centroid.X + length / 2, centroid.Y, centroid.Z}
-      }};
-    } else {
-      return {{
-        {centroid.X, centroid.Y - length / 2, centroid.Z},
-        {centroid.X, centroid.Y + length / 2, centroid.Z}
-      }};
+  // Fingerprint of everything the game reads from a map: the colliders in
+  // order and the first safe points drawn.
+  uint64_t fingerprint(map_t& m) {
+    fnv1a_t hash;
+    const collider_buffer_t& walls = m.get_walls();
+    for (size_t k = 0; k < walls.size(); ++k) {
+      const vector_t c = walls.centroid(k);
+      hash.add(c.X);
+      hash.add(c.Y);
+      hash.add(walls.orientation(k));
+      hash.add(walls.length(k));
+    }
+    for (int k = 0; k < 2; ++k) {
+      vector_t p = m.retrieve_safe_point();
+      hash.add(p.X);
+      hash.add(p.Y);
     }
+    return hash.value();
   }
 
-  [[nodiscard]] double get_angle() const {
-    return (orientation == wall_orientation::H) ? 0.0 : std::numbers::pi / 2;
-  }
-};
-
-using wall_data = std::tuple<double, double, wall_orientation>;
-
-namespace std {
-  template<>
-  struct hash<wall_data> {
-    size_t operator()(const wall_data& key) const {
-      size_t h1 = std::hash<double>()(std::get<0>(key));
-      size_t h2 = std::hash<double>()(std::get<1>(key));
-      size_t h3 = std::hash<int>()(static_cast<int>(std::get<2>(key)));
-      return h1 ^ (h2 << 1) ^ (h3 << 2);
-    }
+  struct golden_t {
+    std::string algorithm;
+    int width, height;
+    uint64_t seed;
+    uint64_t hash;
   };
 
-  template<>
-  struct equal_to<wall_data> {
-    bool operator()(const wall_data& lhs, const wall_data& rhs) const {
-      return std::get<0>(lhs) == std::get<0>(rhs) &&
-             std::get<1>(lhs) == std::get<1>(rhs) &&
-             std::get<2>(lhs) == std::get<2>(rhs);
+  std::vector<golden_t> golden_matrix() {
+    std::vector<golden_t> entries;
+    for (const auto& a : algorithms) {
+      for (int size : {8, 31, 64, 200}) {
+        for (uint64_t seed : {1ull, 2ull, 42ull, 1337ull, 20251ull}) {
+          entries.push_back({a.name, size, size + size / 2, seed, 0});
+        }
+      }
+      for (int size : {200, 300}) {
+        for (uint64_t seed : {1ull, 2ull, 42ull, 1337ull, 20251ull}) {
+          entries.push_back({std::string(a.name) + "@64", size, size + size / 2, seed, 0});
+        }
+      }
     }
-  };
-}
-
-struct map_config_t {
-  int width;
-  int height;
-  int segment_length;
-  int threshold;
-};
-
+    return entries;
+  }
 
-class map_t {
-private:
-  int segment_length;
-  int width;
-  int height;
-  int threshold = 30;
-  std::vector<std::vector<cell_t>> grid;
-  vector_t start;
-  std::vector<std::shared_ptr<collider_t>> walls;
+  // Regenerates every entry and prints its hash and build time. With a golden
+  // file the hashes are compared against it and any difference fails.
+  int golden(const char* path) {
+    std::vector<golden_t> entries;
+    if (path) {
+      std::ifstream ifs(path);
+      golden_t e;
+      while (ifs >> e.algorithm >> e.width >> e.height >> e.seed >> std::hex >> e.hash >> std::dec) {
+        entries.push_back(e);
+      }
+      if (entries.empty()) {
+        std::cerr << "no entries in " << path << "\n";
+        return 1;
+      }
+    } else {
+      entries = golden_matrix();
+    }
 
-  std::mt19937 rng{ std::random_device{}() };
+    int failures = 0;
+    double total = 0;
+    for (const auto& e : entries) {
+      map_config_t config{e.width, e.height, 10, 30};
+      auto [name, tile] = split_tile(e.algorithm);
+      config.algorithm = *parse_algorithm(name.c_str());
+      config.seed = e.seed;
+      config.tile_size = tile;
+
+      auto begin = std::chrono::steady_clock::now();
+      map_t m{config};
+      auto end = std::chrono::steady_clock::now();
+      double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+      total += ms;
+
+      uint64_t hash = fingerprint(m);
+      if (path && hash != e.hash) {
+        ++failures;
+        std::printf("MISMATCH %s %d %d %llu: expected %016llx got %016llx\n",
+          e.algorithm.c_str(), e.width, e.height, static_cast<unsigned long long>(e.seed),
+          static_cast<unsigned long long>(e.hash), static_cast<unsigned long long>(hash));
+      } else if (!path) {
+        std::printf("%s %d %d %llu %016llx\n", e.algorithm.c_str(), e.width, e.height,
+          static_cast<unsigned long long>(e.seed), static_cast<unsigned long long>(hash));
+      }
+    }
 
-public:
-  [[nodiscard]] vector_t centroid() const { return start; }
+    std::fprintf(stderr, "%zu maps, %d mismatches, %.1f ms\n", entries.size(), failures, total);
+    return failures == 0 ? 0 : 1;
+  }
 
-  vector_t retrieve_safe_point() {
-    std::uniform_int_distribution<int> dist_x(0, width - 1);
-    std::uniform_int_distribution<int> dist_y(0, height - 1);
+  // Builds the same tiled maze with 1 to `max_threads` workers next to the
+  // single threaded one. Every tiled run must give the same fingerprint.
+  int parallel(int size, int tile, int max_threads) {
+    std::printf("%-12s %6s %6s %8s %10s %16s\n", "algorithm", "size", "tile", "threads", "time (ms)", "hash");
+
+    int failures = 0;
+    for (const auto& a : algorithms) {
+      map_config_t config{size, size, 10, 30, a.algorithm};
+      config.seed = 42;
+
+      std::optional<uint64_t> reference;
+      for (int threads = 0; threads <= max_threads; threads = threads == 0 ? 1 : threads * 2) {
+        config.tile_size = threads == 0 ? 0 : tile;
+        config.threads = threads;
+
+        auto begin = std::chrono::steady_clock::now();
+        map_t m{config};
+        auto end = std::chrono::steady_clock::now();
+
+        uint64_t hash = fingerprint(m);
+        if (threads > 0) {
+          if (!reference) reference = hash;
+          else if (*reference != hash) ++failures;
+        }
+        std::printf("%-12s %6d %6d %8d %10.1f %016llx\n", a.name, size, config.tile_size, threads,
+          std::chrono::duration<double, std::milli>(end - begin).count(),
+          static_cast<unsigned long long>(hash));
+      }
+    }
 
-    int rx = dist_x(rng);
-    int ry = dist_y(rng);
+    if (failures) std::printf("%d tiled runs depend on the thread count\n", failures);
+    return failures == 0 ? 0 : 1;
+  }
 
-    std::uniform_int_distribution<int> offset(
-      -segment_length * 0.75 / 2, segment_length * 0.75 / 2);
+  // Chunk meshes of a maze: build time on 1 and `threads` threads, size of
+  // the meshes next to the wall colliders they replace, and the rebuild of the
+  // chunks around one changed wall. Every triangle must face its normal.
+  int chunks(int size, int chunk_size, int threads) {
+    map_config_t config{size, size, 500, 30};
+    config.seed = 42;
+    map_t m{config};
+
+    chunk_config_t chunk_config;
+    chunk_config.chunk_size = chunk_size;
+    chunk_config.cell_size = 500;
+
+    auto build = [&](map_chunks_t& chunks, int thread_count) {
+      std::atomic<int> next{0};
+      auto work = [&] {
+        for (int c = next++; c < chunks.chunk_count(); c = next++) chunks.build(c);
+      };
+      std::vector<std::thread> workers;
+      for (int t = 1; t < thread_count; ++t) workers.emplace_back(work);
+      work();
+      for (auto& worker : workers) worker.join();
+    };
 
+    std::printf("%8s %10s\n", "threads", "time (ms)");
+    map_chunks_t chunks(m.emitted_grid(), {}, chunk_config);
+    for (int t = 1; t <= threads; t = t == threads ? t + 1 : std::min(t * 2, threads)) {
+      auto begin = std::chrono::steady_clock::now();
+      build(chunks, t);
+      auto end = std::chrono::steady_clock::now();
+      std::printf("%8d %10.1f\n", t, std::chrono::duration<double, std::milli>(end - begin).count());
+    }
 
-    return vector_t{
-      rx * segment_length + segment_length / 2.0 + offset(rng),
-      ry * segment_length + segment_length / 2.0 + offset(rng),
-      0.0
-    };
+    size_t vertices = 0, triangles = 0, boxes = 0;
+    int bad_faces = 0;
+    // Cell edges covered by the wall boxes, the same count as the colliders.
+    long wall_edges = 0;
+    for (int c = 0; c < chunks.chunk_count(); ++c) {
+      const chunk_mesh_t& mesh = chunks.mesh(c);
+      vertices += mesh.vertices.size();
+      triangles += mesh.triangles.size() / 3;
+      boxes += mesh.boxes.size();
+      for (const chunk_box_t& box : mesh.boxes) {
+        if (box.center.Z < 0) continue;
+        wall_edges += std::lround((2 * std::max(box.extent.X, box.extent.Y) - chunk_config.wall_thickness) / chunk_config.cell_size);
+      }
+      for (size_t t = 0; t < mesh.triangles.size(); t += 3) {
+        const vector_t& a = mesh.vertices[mesh.triangles[t]];
+        const vector_t& b = mesh.vertices[mesh.triangles[t + 1]];
+        const vector_t& d = mesh.vertices[mesh.triangles[t + 2]];
+        const vector_t& n = mesh.normals[mesh.triangles[t]];
+        double ux = b.X - a.X, uy = b.Y - a.Y, uz = b.Z - a.Z;
+        double vx = d.X - a.X, vy = d.Y - a.Y, vz = d.Z - a.Z;
+        double facing = (uy * vz - uz * vy) * n.X + (uz * vx - ux * vz) * n.Y + (ux * vy - uy * vx) * n.Z;
+        bad_faces += facing <= 0;
+      }
+    }
+    std::printf("%d chunks, %zu wall colliders -> %zu boxes over %ld edges, %zu vertices, %zu triangles, %d bad faces\n",
+      chunks.chunk_count(), m.get_walls().size(), boxes, wall_edges, vertices, triangles, bad_faces);
+    const bool same_walls = wall_edges == static_cast<long>(m.get_walls().size());
+
+    // Opens a wall in the middle of the maze, only the chunks around it are rebuilt.
+    // A build from a snapshot taken before keeps the old wall, the grid is
+    // copied instead of changed under it.
+    const int i = size / 2, j = size / 2;
+    std::vector<int> touched = chunks.chunks_touching({j, i, 2, 1});
+    const size_t old_boxes = chunks.mesh(touched.front()).boxes.size();
+    std::shared_ptr<const wall_grid_t> snapshot = chunks.snapshot();
+    std::thread builder([&] { chunks.build(touched.front(), *snapshot); });
+    chunks.get_grid().set_wall(i, j, 2, !chunks.get_grid().is_wall(i, j, 2));
+    builder.join();
+    const bool snapshot_kept = snapshot->is_wall(i, j, 2) != chunks.get_grid().is_wall(i, j, 2) &&
+      chunks.mesh(touched.front()).boxes.size() == old_boxes;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int c : touched) chunks.build(c);
+    auto end = std::chrono::steady_clock::now();
+    std::printf("region rebuild: %zu chunks, %.3f ms, snapshot %s\n", touched.size(),
+      std::chrono::duration<double, std::milli>(end - begin).count(), snapshot_kept ? "kept" : "CHANGED");
+
+    return bad_faces == 0 && same_walls && snapshot_kept ? 0 : 1;
   }
 
-  std::vector<std::shared_ptr<collider_t>>& get_walls() { return walls; }
-
-  map_t(const map_config_t& config)
-      : width(config.width), height(config.height), grid(config.height, std::vector<cell_t>(config.height)), 
-        segment_length(config.segment_length), threshold(config.threshold) {
-    prim(
-      {std::uniform_int_distribution<int>(0, width - 1)(rng),
-      std::uniform_int_distribution<int>(0, height - 1)(rng)}
-    );
-    random_remove_wall();
-    generate_colliders();
+  // What RegenerateMap does between two seeds: time to compute the new map
+  // and how many of its colliders match one of the old map, those keep their
+  // component. The others reuse the pooled components.
+  int regen(int size, uint64_t from, uint64_t to) {
+    map_config_t config{size, size, 500, 30};
+    config.seed = from;
+    map_t old_map{config};
+
+    config.seed = to;
+    auto begin = std::chrono::steady_clock::now();
+    map_t new_map{config};
+    auto generated = std::chrono::steady_clock::now();
+
+    auto key = [](const collider_buffer_t& walls, size_t k) {
+      return std::tuple{walls.grid_x()[k], walls.grid_y()[k], walls.is_vertical(k), walls.grid_length()[k]};
+    };
+    std::set<std::tuple<int32_t, int32_t, bool, int32_t>> old_keys;
+    for (size_t k = 0; k < old_map.get_walls().size(); ++k) old_keys.insert(key(old_map.get_walls(), k));
+    size_t kept = 0;
+    for (size_t k = 0; k < new_map.get_walls().size(); ++k) kept += old_keys.erase(key(new_map.get_walls(), k));
+    auto end = std::chrono::steady_clock::now();
+
+    const size_t count = new_map.get_walls().size();
+    std::printf("%zu walls: %zu kept, %zu moved from the pool, %zu pooled, %zu created\n", count, kept,
+      std::min(count - kept, old_keys.size()), old_keys.size() > count - kept ? old_keys.size() - (count - kept) : 0,
+      count - kept > old_keys.size() ? count - kept - old_keys.size() : 0);
+    std::printf("layout %.1f ms, diff %.1f ms\n",
+      std::chrono::duration<double, std::milli>(generated - begin).count(),
+      std::chrono::duration<double, std::milli>(end - generated).count());
+    return 0;
   }
 
-  [[nodiscard]] std::string latex() const {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(2);
-
-    oss << "\\documentclass[margin=5mm,tikz]{standalone}\n"
-        << "\\usepackage{tikz}\n"
-        << "\\begin{document}\n";
-
-    oss << "\\begin{tikzpicture}[scale=0.5]\n";
-    for (const auto& wall : walls) {
-      const auto& c = wall->centroid;
-      double half = wall->length / 2.0;
-
-      if (wall->orientation == wall_orientation::H) {
-        oss << "\\draw (" << c.X - half << "," << c.Y << ") -- ("
-            << c.X + half << "," << c.Y << ");\n";
-      } else {
-        oss << "\\draw (" << c.X << "," << c.Y - half << ") -- ("
-            << c.X << "," << c.Y + half << ");\n";
+  // Regenerates a region of a size x size maze and checks that the maze is
+  // still connected and that the changes reported are exactly the colliders
+  // that appeared or disappeared over the whole map. Also copies the emitted
+  // walls of the region grown by one cell into the old emitted grid, as the
+  // chunks do, the region may touch the border.
+  int region(int size, grid_rect_t area, uint64_t seed) {
+    map_config_t config{size, size, 10, 30};
+    config.seed = seed;
+    map_t m{config};
+
+    auto emitted = [&] {
+      std::vector<uint8_t> edges;
+      for (int i = 0; i <= size; ++i) {
+        for (int j = 0; j <= size; ++j) {
+          edges.push_back(j < size && m.emits_wall(i, j, true));
+          edges.push_back(i < size && m.emits_wall(i, j, false));
+        }
+      }
+      return edges;
+    };
+    std::vector<uint8_t> before = emitted();
+    wall_grid_t copy = m.emitted_grid();
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<wall_change_t> changes = m.regenerate_region(area, 1);
+    auto end = std::chrono::steady_clock::now();
+
+    for (const wall_change_t& change : changes) {
+      const bool horizontal = change.wall.orientation == wall_orientation::H;
+      const int i = static_cast<int>(std::floor(change.wall.centroid.Y / 10));
+      const int j = static_cast<int>(std::floor(change.wall.centroid.X / 10));
+      before[2 * (static_cast<size_t>(i) * (size + 1) + j) + (horizontal ? 0 : 1)] = change.added;
+    }
+    const int mismatches = static_cast<int>(std::inner_product(before.begin(), before.end(), emitted().begin(), 0,
+      std::plus<>(), std::not_equal_to<>()));
+
+    m.copy_emitted(copy, {area.x - 1, area.y - 1, area.width + 2, area.height + 2});
+    const wall_grid_t emitted_grid = m.emitted_grid();
+    int copy_mismatches = 0;
+    for (int i = 0; i < size; ++i) {
+      for (int j = 0; j < size; ++j) {
+        for (int dir = 0; dir < 4; ++dir) copy_mismatches += copy.is_wall(i, j, dir) != emitted_grid.is_wall(i, j, dir);
       }
     }
 
-    oss << "\\end{tikzpicture}\n\\end{document}";
+    distance_field_t field(emitted_grid, {0, 0});
+    const bool connected = field.reachable_count() == static_cast<size_t>(size) * size;
 
-    return oss.str();
+    std::printf("%zu changes, %d mismatches, %d copied cells differ, %s, %.3f ms\n", changes.size(), mismatches,
+      copy_mismatches, connected ? "connected" : "NOT CONNECTED", std::chrono::duration<double, std::milli>(end - begin).count());
+    return mismatches == 0 && copy_mismatches == 0 && connected ? 0 : 1;
   }
 
-private:
-  void prim(point_t s) {
-    std::vector<std::array<int, 5>> queue;
-    std::unordered_set<point_t> visited;
-
-    visited.insert(s);
+  // Player and ghost placement through the distance field, prints the path
+  // distance of the ghost next to the straight line one.
+  int spawn(int width, int height, uint64_t seed, int min_distance) {
+    map_config_t config{width, height, 10, 30};
+    config.seed = seed;
+    map_t m{config};
+
+    auto begin = std::chrono::steady_clock::now();
+    spawn_points_t spawns = m.retrieve_spawn_points(min_distance, width * height);
+    auto end = std::chrono::steady_clock::now();
+
+    distance_field_t field(m.emitted_grid(), {static_cast<int>(spawns.player.Y) / 10, static_cast<int>(spawns.player.X) / 10});
+    int path = field.at(static_cast<int>(spawns.ghost.Y) / 10, static_cast<int>(spawns.ghost.X) / 10);
+    std::printf("player (%.0f, %.0f) ghost (%.0f, %.0f) path %d cells (max %d), straight line %.1f cells, %.2f ms\n",
+      spawns.player.X, spawns.player.Y, spawns.ghost.X, spawns.ghost.Y, path, field.max_distance(),
+      std::hypot(spawns.ghost.X - spawns.player.X, spawns.ghost.Y - spawns.player.Y) / 10,
+      std::chrono::duration<double, std::milli>(end - begin).count());
+    return 0;
+  }
 
-    for (int i = 0; i < direction.size(); ++i) {
-      const auto& dir = direction[i];
-      queue.push_back({s.x + dir.x, s.y + dir.y, i, s.x, s.y});
+  // Poisson-disk ball placement over a maze of 500 unit cells, checks the
+  // spacing of the balls and their clearance to the walls.
+  int balls(int size, int count, uint64_t seed) {
+    map_config_t config{size, size, 500, 30};
+    config.seed = seed;
+    map_t m{config};
+
+    ball_placement_config_t settings{count, 300, 100};
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<vector_t> positions = m.retrieve_balls(settings);
+    auto end = std::chrono::steady_clock::now();
+
+    double closest = 1e30;
+    for (size_t a = 0; a < positions.size() && positions.size() <= 20000; ++a) {
+      for (size_t b = a + 1; b < positions.size(); ++b) {
+        closest = std::min(closest, std::hypot(positions[a].X - positions[b].X, positions[a].Y - positions[b].Y));
+      }
     }
 
-    while(!queue.empty()) {
-      std::uniform_int_distribution<int> dist(0, queue.size() - 1);
-      size_t idx = dist(rng);
-
-      auto wall = queue[idx];
-      queue.erase(queue.begin() + idx);
-
-      int nx = wall[0];
-      int ny = wall[1];
-      int dir = wall[2];
-      int px = wall[3];
-      int py = wall[4];
+    int too_close = 0;
+    const wall_grid_t grid = m.emitted_grid();
+    for (const auto& p : positions) {
+      int i = static_cast<int>(p.Y / 500), j = static_cast<int>(p.X / 500);
+      double u = p.X - j * 500, v = p.Y - i * 500;
+      too_close += (u < 100 && grid.is_wall(i, j, 3)) || (500 - u < 100 && grid.is_wall(i, j, 2)) ||
+                   (v < 100 && grid.is_wall(i, j, 0)) || (500 - v < 100 && grid.is_wall(i, j, 1));
+    }
 
-      point_t next{nx, ny};
+    std::printf("%zu/%d balls in %.2f ms, closest pair %.1f, %d too close to a wall\n",
+      positions.size(), count, std::chrono::duration<double, std::milli>(end - begin).count(), closest, too_close);
+    return too_close == 0 ? 0 : 1;
+  }
 
-      if (nx >= 0 && nx < width && ny >= 0 && ny < height &&
-          visited.find(next) == visited.end()) {
-        visited.insert(next);
+  // Writes the maze to maze.tex while it is generated, the full grid is never
+  // held in memory so the height is only limited by the disk.
+  int stream(int width, int height, uint64_t seed) {
+    map_config_t config{width, height, 10, 0};
+    config.seed = seed;
+    maze_stream_t maze{config};
+    std::ofstream ofs("maze.tex");
+    ofs << std::fixed << std::setprecision(2)
+        << "\\documentclass[margin=5mm,tikz]{standalone}\n"
+        << "\\usepackage{tikz}\n"
+        << "\\begin{document}\n"
+        << "\\begin{tikzpicture}[scale=0.5]\n";
+
+    size_t count = 0;
+    maze.generate([&](int, const std::vector<collider_t>& walls) {
+      for (const auto& wall : walls) {
+        auto [a, b] = wall.get_endpoints();
+        ofs << "\\draw (" << a.X << "," << a.Y << ") -- (" << b.X << "," << b.Y << ");\n";
+      }
+      count += walls.size();
+    });
 
-        remove_wall(point_t{px, py}, next, dir);
+    ofs << "\\end{tikzpicture}\n\\end{document}";
+    std::cout << count << " walls written to maze.tex\n";
+    return 0;
+  }
+}
 
-        for (int i = 0; i < direction.size(); ++i) {
-          const auto& dirc = direction[i];
-          queue.push_back({nx + dirc.x, ny + dirc.y, i, nx, ny});
-        }
-      }
-    }
+int main(int argc, char** argv) {
+  if (argc > 1 && std::strcmp(argv[1], "bench") == 0) {
+    std::vector<int> sizes;
+    for (int i = 2; i < argc; ++i) sizes.push_back(std::atoi(argv[i]));
+    if (sizes.empty()) sizes = {64, 256, 1024, 2048};
+    return bench(sizes);
   }
 
-  void random_remove_wall() {
-    std::vector<std::vector<int>> density;
+  if (argc > 1 && std::strcmp(argv[1], "parallel") == 0) {
+    int size = argc > 2 ? std::atoi(argv[2]) : 4096;
+    int tile = argc > 3 ? std::atoi(argv[3]) : 256;
+    int threads = argc > 4 ? std::atoi(argv[4]) : static_cast<int>(std::thread::hardware_concurrency());
+    return parallel(size, tile, std::max(threads, 1));
+  }
 
-    for (size_t si = 0; si < grid.size() - 4; ++si) {
-      for (size_t sj = 0; sj < grid[si].size() - 4; ++sj) {
-        int wall_count = 0;
-        for (size_t i = si; i < si + 4; ++i) {
-          for (size_t j = sj; j < sj + 4; ++j) {
-            wall_count += grid[i][j].n + grid[i][j].s + grid[i][j].e + grid[i][j].w;
-          }
-        }
-        density.push_back({static_cast<int>(si), static_cast<int>(sj), wall_count});
-      }
-    }
+  if (argc > 1 && std::strcmp(argv[1], "chunks") == 0) {
+    int size = argc > 2 ? std::atoi(argv[2]) : 1024;
+    int chunk_size = argc > 3 ? std::atoi(argv[3]) : 32;
+    int threads = argc > 4 ? std::atoi(argv[4]) : static_cast<int>(std::thread::hardware_concurrency());
+    return chunks(size, chunk_size, std::max(threads, 1));
+  }
 
-    for (const auto& d : density) {
-      if (d[2] > threshold) {
-        std::uniform_int_distribution<int> dist_i(d[0], d[0] + 3);
-        std::uniform_int_distribution<int> dist_j(d[1], d[1] + 3);
-        int ri = dist_i(rng);
-        int rj = dist_j(rng);
-
-        std::vector<int> possible_walls;
-        if (grid[ri][rj].n) possible_walls.push_back(0);
-        if (grid[ri][rj].s) possible_walls.push_back(1);
-        if (grid[ri][rj].e) possible_walls.push_back(2);
-        if (grid[ri][rj].w) possible_walls.push_back(3);
-
-        if (!possible_walls.empty()) {
-          std::uniform_int_distribution<int> dist_wall(0, possible_walls.size() - 1);
-          int wall_dir = possible_walls[dist_wall(rng)];
-
-          point_t p1{ri, rj};
-          point_t p2{ri + direction[wall_dir].x, rj + direction[wall_dir].y};
-          
-          if (p2.x >= 0 && p2.x < width && p2.y >= 0 && p2.y < height)
-            remove_wall(p1, p2, wall_dir);
-        }
-      }
-    }
+  if (argc > 1 && std::strcmp(argv[1], "hash") == 0) {
+    return golden(nullptr);
   }
 
-  void remove_wall(point_t p1, point_t p2, int dir) {
-    if (dir == 0) {
-      grid[p1.x][p1.y].n = false;
-      grid[p2.x][p2.y].s = false;
-    } else if (dir == 1) {
-      grid[p1.x][p1.y].s = false;
-      grid[p2.x][p2.y].n = false;
-    } else if (dir == 2) {
-      grid[p1.x][p1.y].e = false;
-      grid[p2.x][p2.y].w = false;
-    } else if (dir == 3) {
-      grid[p1.x][p1.y].w = false;
-      grid[p2.x][p2.y].e = false;
-    }
+  if (argc > 2 && std::strcmp(argv[1], "check") == 0) {
+    return golden(argv[2]);
   }
 
-  void generate_colliders() {
-    std::unordered_set<wall_data> unique_walls;
-    walls.clear();
+  uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : std::random_device{}();
+  std::cerr << "seed " << seed << "\n";
 
-    auto is_border = [this](size_t i, size_t j) {
-      return i == 0 || j == 0 || i == height - 1 || j == width - 1;
-    };
+  if (argc > 3 && std::strcmp(argv[1], "spawn") == 0) {
+    return spawn(std::atoi(argv[2]), std::atoi(argv[3]), seed, argc > 5 ? std::atoi(argv[5]) : 10);
+  }
 
-    for (size_t i = 0; i < grid.size(); ++i) {
-      for (size_t j = 0; j < grid[i].size(); ++j) {
-        const auto& cell = grid[i][j];
-        if (cell.has_single_wall() && !is_border(i, j))
-          continue;
+  if (argc > 3 && std::strcmp(argv[1], "balls") == 0) {
+    return balls(std::atoi(argv[2]), std::atoi(argv[3]), seed);
+  }
 
-        double iw = i * segment_length;
-        double jw = j * segment_length;
+  if (argc > 6 && std::strcmp(argv[1], "region") == 0) {
+    grid_rect_t area{std::atoi(argv[3]), std::atoi(argv[4]), std::atoi(argv[5]), std::atoi(argv[6])};
+    return region(std::atoi(argv[2]), area, argc > 7 ? std::strtoull(argv[7], nullptr, 10) : 42);
+  }
 
-        if (cell.n || i == 0) {
-          unique_walls.insert({
-            jw + segment_length / 2.0, iw, 
-            wall_orientation::H});
-        }
-        if (cell.s || i == height - 1) {
-          unique_walls.insert({
-            jw + segment_length / 2.0, iw + segment_length, 
-            wall_orientation::H});
-        }
-        if (cell.e || j == width - 1) {
-          unique_walls.insert({
-            jw + segment_length, iw + segment_length / 2.0, 
-            wall_orientation::V});
-        }
-        if (cell.w || j == 0) {
-          unique_walls.insert({
-            jw, iw + segment_length / 2.0, 
-            wall_orientation::V});
-        }
-      }
-    }
+  if (argc > 3 && std::strcmp(argv[1], "regen") == 0) {
+    return regen(std::atoi(argv[2]), std::strtoull(argv[3], nullptr, 10), seed);
+  }
 
-    for (const auto& wall : unique_walls) {
-      double x = std::get<0>(wall);
-      double y = std::get<1>(wall);
-      wall_orientation o = std::get<2>(wall);
+  if (argc > 3 && std::strcmp(argv[1], "stream") == 0) {
+    return stream(std::atoi(argv[2]), std::atoi(argv[3]), seed);
+  }
 
-      walls.push_back(std::make_shared<collider_t>(
-        vector_t{x, y, 0.0},
-        o,
-        static_cast<double>(segment_length)));
+  map_config_t config{10, 10, 10, 30};
+  config.seed = seed;
+  if (argc > 1) {
+    auto algorithm = parse_algorithm(argv[1]);
+    if (!algorithm) {
+      std::cerr << "usage: maze [prim|kruskal|wilson|backtracker [width height [seed]]]\n"
+                << "       maze bench [size...]\n"
+                << "       maze stream width height [seed]\n"
+                << "       maze spawn width height [seed [min distance]]\n"
+                << "       maze balls size count [seed]\n"
+                << "       maze parallel [size [tile [threads]]]\n"
+                << "       maze chunks [size [chunk size [threads]]]\n"
+                << "       maze regen size old_seed new_seed\n"
+                << "       maze region size x y width height [seed]\n"
+                << "       maze hash\n"
+                << "       maze check golden.txt\n";
+      return 1;
     }
+    config.algorithm = *algorithm;
+  }
+  if (argc > 3) {
+    config.width = std::atoi(argv[2]);
+    config.height = std::atoi(argv[3]);
   }
-};
 
-int main() {
-  map_t m{{10, 10, 10, 30}};
+  map_t m{config};
   std::ofstream ofs("maze.tex");
   ofs << m.latex();
 
@@ -1,405 +1,406 @@
-#include <iostream>
-#include <vector>
+#define MAPGEN_STANDALONE
+#include "../NinetyNinePinkBalls/Source/NinetyNinePinkBalls/MapGeneration/Pavage.h"
+
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <climits>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
 #include <random>
-#include <array>
-#include <unordered_set>
-#include <unordered_map>
-#include <numbers>
-#include <set>
-#include <memory>
-#include <iomanip>
-
-template<typename T>
-struct TVector{ T X; T Y; T Z; };
-using FVector = TVector<double>;
-using vector_t = FVector;
-
-
-struct point_t {
-  int x, y;
-  bool operator==(const point_t& oth) const {
-    return x == oth.x && y == oth.y;
-  }
-  bool operator<(const point_t& oth) const {
-    if (x != oth.x) return x < oth.x;
-    return y < oth.y;
-  }
-};
 
-namespace std {
-  template<>
-  struct hash<point_t> {
-    size_t operator()(const point_t& p) const {
-      return std::hash<int>()(p.x) ^ (std::hash<int>()(p.y) << 1);
+namespace {
+  // Fingerprint of everything the game reads from a map: the colliders in
+  // order and the first safe points drawn.
+  uint64_t fingerprint(pavage::map_t& m) {
+    fnv1a_t hash;
+    const collider_buffer_t& walls = m.get_walls();
+    for (size_t k = 0; k < walls.size(); ++k) {
+      const vector_t c = walls.centroid(k);
+      hash.add(c.X);
+      hash.add(c.Y);
+      hash.add(walls.orientation(k));
+      hash.add(walls.length(k));
+      hash.add(walls.is_door(k));
     }
-  };
-}
-
-inline constexpr std::array<point_t, 4> direction = {{
-  {-1, 0}, {1, 0}, {0, 1}, {0, -1}
-}};
-
-struct cell_t {
-  bool n = true, s = true, e = true, w = true;
-  
-  [[nodiscard]] bool is_wall(int pos) const {
-    switch (pos) {
-      case 0: return n;
-      case 1: return s;
-      case 2: return e;
-      case 3: return w;
-      default: return false;
+    for (int k = 0; k < 2; ++k) {
+      vector_t p = m.retrieve_safe_point();
+      hash.add(p.X);
+      hash.add(p.Y);
     }
+    return hash.value();
   }
-};
-
-enum class wall_orientation { H, V };
-
-namespace pavage {
-  using shape_t = std::vector<std::pair<int, int>>;
-  using const_ref_shape_t = const shape_t&;
-
-  struct piece_t {
-    shape_t cells;
-    int type;
-    int max_count;
-    int used_count = 0;
-
-    auto get_variants() const {
-      std::vector<shape_t> variants;
-      auto current = cells;
-      
-      for (int flip = 0; flip < 2; ++flip) {
-        for (int rot = 0; rot < 4; ++rot) {
-          int minx = INT_MAX, miny = INT_MAX;
-          for (auto [x, y] : current) {
-            minx = std::min(minx, x);
-            miny = std::min(miny, y);
-          }
-
-          shape_t normalized;
-          for (auto [x, y] : current) {
-            normalized.push_back({ x - minx, y - miny });
-          }
-
-          std::sort(normalized.begin(), normalized.end());
-          if (std::find(variants.begin(), variants.end(), normalized) == variants.end()) {
-            variants.push_back(normalized);
-          }
-          for (auto& [x, y] : current) { std::tie(x, y) = std::make_pair(-y, x); }
+
+  struct golden_t {
+    int width, height;
+    uint64_t seed;
+    uint64_t hash;
+  };
+
+  // Same as maze.cpp: prints the hash of every map of the matrix, or checks
+  // them against a golden file. Uses the piece set of the game.
+  int golden(const char* path) {
+    std::vector<golden_t> entries;
+    if (path) {
+      std::ifstream ifs(path);
+      golden_t e;
+      while (ifs >> e.width >> e.height >> e.seed >> std::hex >> e.hash >> std::dec) {
+        entries.push_back(e);
+      }
+      if (entries.empty()) {
+        std::cerr << "no entries in " << path << "\n";
+        return 1;
+      }
+    } else {
+      for (int size : {10, 20, 40}) {
+        for (uint64_t seed : {1ull, 2ull, 42ull, 1337ull, 20251ull}) {
+          entries.push_back({size, size + size / 2, seed, 0});
         }
-        for (auto& [x, y] : current) { x = -x; }
       }
-  
-      return variants;
     }
-  };
 
-  struct collider_t {
-    vector_t centroid;
-    wall_orientation orientation;
-    double length;
-    bool is_door;
-
-    collider_t(vector_t c, wall_orientation o, double l, bool d)
-      : centroid(c), orientation(o), length(l), is_door(d) {}
-
-    [[nodiscard]] std::array<vector_t, 2> get_endpoints() const {
-      if (orientation == wall_orientation::H) {
-        return {{
-          { centroid.X - length / 2, centroid.Y, centroid.Z },
-          { centroid.X + length / 2, centroid.Y, centroid.Z }
-        }};
-      } else {
-        return {{
-          { centroid.X, centroid.Y - length / 2, centroid.Z },
-          { centroid.X, centroid.Y + length / 2, centroid.Z }
-        }};
+    int failures = 0;
+    double total = 0;
+    for (const auto& e : entries) {
+      auto begin = std::chrono::steady_clock::now();
+      pavage::map_t m(e.width, e.height, 10, pavage::pieces, e.seed);
+      auto end = std::chrono::steady_clock::now();
+      total += std::chrono::duration<double, std::milli>(end - begin).count();
+
+      uint64_t hash = fingerprint(m);
+      if (path && hash != e.hash) {
+        ++failures;
+        std::printf("MISMATCH %d %d %llu: expected %016llx got %016llx\n",
+          e.width, e.height, static_cast<unsigned long long>(e.seed),
+          static_cast<unsigned long long>(e.hash), static_cast<unsigned long long>(hash));
+      } else if (!path) {
+        std::printf("%d %d %llu %016llx\n", e.width, e.height,
+          static_cast<unsigned long long>(e.seed), static_cast<unsigned long long>(hash));
       }
     }
 
-    [[nodiscard]] double get_angle() const {
-      return (orientation == wall_orientation::H) ? 0.0 : std::numbers::pi / 2;
-    }
-  };
+    std::fprintf(stderr, "%zu maps, %d mismatches, %.1f ms\n", entries.size(), failures, total);
+    return failures == 0 ? 0 : 1;
+  }
 
-  class placement_t {
-    int width, height, placement_id = 0;
-    std::vector<piece_t> pieces;
-    std::vector<std::vector<int>> grid;
-    int placements = 0;
-    std::mt19937 rng{std::random_device{}()};
-
-    bool can_place(const_ref_shape_t shape, int x, int y) {
-      for (auto [dx, dy] : shape) {
-        int nx = x + dx, ny = y + dy;
-        if (nx < 0 || nx >= width || ny < 0 || ny >= height || grid[ny][nx] != -1) { 
-          return false; 
-        }
-      }
-      return true;
-    }
+  // Floor rectangles of a map: every cell covered by a piece must be in
+  // exactly one rectangle of its material and the empty cells in none.
+  int floor(int width, int height, uint64_t seed) {
+    pavage::map_t m(width, height, 10, pavage::pieces, seed);
+    const std::vector<int> rooms = m.placer.room_map();
 
-    bool touches_existing(const_ref_shape_t shape, int x, int y) {
-      if (placements == 0) { return true; }
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<floor_rect_t> rects = m.retrieve_floor();
+    auto end = std::chrono::steady_clock::now();
 
-      for (auto [dx, dy] : shape) {
-        int cx = x + dx, cy = y + dy;
-        shape_t neighbors = {{cx-1,cy}, {cx+1,cy}, {cx,cy-1}, {cx,cy+1}};
-        for (auto [nx, ny] : neighbors) {
-          if (nx >= 0 && nx < width && ny >= 0 && ny < height && grid[ny][nx] != -1) 
-            return true;
-        }
+    std::vector<int> cover(rooms.size(), 0);
+    for (const floor_rect_t& r : rects) {
+      for (int i = r.y; i < r.y + r.height; ++i) {
+        for (int j = r.x; j < r.x + r.width; ++j) ++cover[static_cast<size_t>(i) * width + j];
       }
-      return false;
+    }
+    int cells = 0, errors = 0;
+    for (size_t k = 0; k < rooms.size(); ++k) {
+      cells += rooms[k] >= 0;
+      errors += cover[k] != (rooms[k] >= 0 ? 1 : 0);
     }
 
-    void place(int piece_idx, const_ref_shape_t shape, int x, int y) {
-      for (auto [dx, dy] : shape) {
-        grid[y + dy][x + dx] = placement_id;
+    std::printf("%d floor cells, %zu rectangles, %d errors, %.3f ms\n", cells, rects.size(), errors,
+      std::chrono::duration<double, std::milli>(end - begin).count());
+    return errors == 0 ? 0 : 1;
+  }
+
+  // Checks that sweep_wall_segments gives the segments of
+  // extract_wall_segments, doors included, on the maps of the golden matrix
+  // and on a size x size grid of random rectangular rooms with holes, then
+  // times both on that grid.
+  int segments(int size, uint64_t seed) {
+    using grid_t = std::vector<std::vector<int>>;
+    auto same = [](const std::vector<pavage::collider_gen_t::segment_t>& a,
+                   const std::vector<pavage::collider_gen_t::segment_t>& b) {
+      return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto& s, const auto& t) {
+        return s == t && s.is_door == t.is_door && s.length == t.length;
+      });
+    };
+
+    int failures = 0;
+    for (int width : {10, 20, 40}) {
+      for (uint64_t map_seed : {1ull, 2ull, 42ull, 1337ull, 20251ull}) {
+        const int height = width + width / 2;
+        pavage::map_t m(width, height, 10, pavage::pieces, map_seed);
+        const std::vector<int> rooms = m.room_map();
+        grid_t grid(height);
+        for (int y = 0; y < height; ++y) grid[y].assign(rooms.begin() + y * width, rooms.begin() + (y + 1) * width);
+
+        pavage::collider_gen_t gen{width, height, 10.0};
+        failures += !same(gen.extract_wall_segments(grid), gen.sweep_wall_segments(grid));
       }
-      placement_id++;
-      placements++;
-      pieces[piece_idx].used_count++;
     }
 
-    struct collider_gen_t {
-      int width, height;
-      double cell_size;
-
-      struct segment_t {
-        int x, y;
-        bool is_horizontal;
-        bool is_door = false;
-        
-        bool operator==(const segment_t& oth) const {
-          return x == oth.x && y == oth.y && is_horizontal == oth.is_horizontal;
+    rng_t rng(seed);
+    grid_t grid(size, std::vector<int>(size, -1));
+    int room = 0;
+    for (int y = 0; y < size; y += rng.uniform(1, 6)) {
+      for (int x = 0; x < size; x += rng.uniform(1, 6)) {
+        const int id = rng.uniform(0, 9) == 0 ? -1 : room++;
+        for (int dy = 0; dy < 6 && y + dy < size; ++dy) {
+          for (int dx = 0; dx < 6 && x + dx < size; ++dx) grid[y + dy][x + dx] = id;
         }
+      }
+    }
 
-        bool operator<(const segment_t& oth) const {
-          if (is_horizontal != oth.is_horizontal) 
-            return is_horizontal < oth.is_horizontal;
-          if (is_horizontal) {
-            if (y != oth.y) return y < oth.y;
-            return x < oth.x;
-          } else {
-            if (x != oth.x) return x < oth.x;
-            return y < oth.y;
-          }
-        } 
-      };
-
-      std::vector<segment_t> extract_wall_segments(std::vector<std::vector<int>> grid) {
-        std::set<segment_t> segments;
-        std::vector<std::tuple<int, int, bool>> doors;
-        std::set<std::pair<int, int>> visited{};
-
-        for (int y = 0; y < height; ++y) {
-          for (int x = 0; x < width; ++x) {
-            int current = grid[y][x];
-
-            if (y == 0 || grid[y-1][x] != current) {
-              if (y == 0 || visited.contains({grid[y-1][x], current}) || grid[y-1][x] == -1 || current == -1)
-                segments.insert({x, y, true});
-              else {
-                segments.insert({x, y, true, true});
-                visited.insert({grid[y-1][x], current});
-                visited.insert({current, grid[y-1][x]});
-              }
-            }
-              
-
-            if (y == height - 1 || grid[y+1][x] != current) {
-              if (y == height - 1 || visited.contains({grid[y+1][x], current}) || grid[y+1][x] == -1 || current == -1)
-                segments.insert({x, y + 1, true});
-              else {
-                segments.insert({x, y + 1, true, true});
-                visited.insert({grid[y+1][x], current});
-                visited.insert({current, grid[y+1][x]});
-              }
-            }
-
-            if (x == 0 || grid[y][x-1] != current) {
-              if (x == 0 || visited.contains({grid[y][x-1], current}) || grid[y][x-1] == -1 || current == -1)
-                segments.insert({x, y, false});
-              else {
-                segments.insert({x, y, false, true});
-                visited.insert({grid[y][x-1], current});
-                visited.insert({current, grid[y][x-1]});
-              }
-            }
-
-            if (x == width - 1 || grid[y][x+1] != current) {
-              if (x == width - 1 || visited.contains({grid[y][x+1], current}) || grid[y][x+1] == -1 || current == -1)
-                segments.insert({x + 1, y, false});
-              else {
-                segments.insert({x + 1, y, false, true});
-                visited.insert({grid[y][x+1], current});
-                visited.insert({current,grid[y][x+1]});
-              }
-            }
-          }
-        }
+    pavage::collider_gen_t gen{size, size, 10.0};
+    auto begin = std::chrono::steady_clock::now();
+    auto reference = gen.extract_wall_segments(grid);
+    auto middle = std::chrono::steady_clock::now();
+    auto sweep = gen.sweep_wall_segments(grid);
+    auto end = std::chrono::steady_clock::now();
+    failures += !same(reference, sweep);
+
+    const auto doors = std::count_if(sweep.begin(), sweep.end(), [](const auto& seg) { return seg.is_door; });
+    std::printf("%zu segments, %td doors, %d mismatches, sets %.1f ms, sweep %.1f ms\n", sweep.size(), doors, failures,
+      std::chrono::duration<double, std::milli>(middle - begin).count(),
+      std::chrono::duration<double, std::milli>(end - middle).count());
+    return failures == 0 ? 0 : 1;
+  }
 
-        return std::vector<segment_t>(segments.begin(), segments.end());
-      }
+  // Doors of a random spanning tree of the rooms plus loop_fraction of the
+  // other pairs: every room must be reached through the doors, in the room
+  // graph and in the wall grid, and the walls must hold one door per pair
+  // given one.
+  int rooms(int width, int height, uint64_t seed, double loop_fraction) {
+    auto begin = std::chrono::steady_clock::now();
+    pavage::map_t m(width, height, 10, pavage::pieces, seed, false, {true, loop_fraction});
+    auto end = std::chrono::steady_clock::now();
+
+    const pavage::room_graph_t& graph = m.room_graph();
+    int doors = 0;
+    for (int k = 0; k < graph.pair_count(); ++k) doors += graph.pair(k).door >= 0;
+    int wall_doors = 0;
+    for (size_t k = 0; k < m.get_walls().size(); ++k) wall_doors += m.get_walls().is_door(k);
+
+    const std::vector<int> room_of = m.room_map();
+    const auto first = std::find_if(room_of.begin(), room_of.end(), [](int room) { return room >= 0; });
+    size_t reachable = 0;
+    if (first != room_of.end()) {
+      const int cell = static_cast<int>(first - room_of.begin());
+      reachable = distance_field_t(m.retrieve_wall_grid(), {cell / width, cell % width}).reachable_count();
+    }
+    const auto covered = static_cast<size_t>(std::count_if(room_of.begin(), room_of.end(), [](int room) { return room >= 0; }));
 
-      std::vector<std::shared_ptr<collider_t>> generate_colliders(std::vector<segment_t> segments) {
-        std::vector<std::shared_ptr<collider_t>> colliders;
+    const bool ok = graph.is_connected() && reachable == covered && wall_doors == doors && doors >= graph.room_count() - 1;
+    std::printf("%d rooms, %d adjacent pairs, %d doors (%d in the tree), %zu of %zu cells reachable, %s, %.1f ms\n",
+      graph.room_count(), graph.pair_count(), doors, std::max(graph.room_count() - 1, 0), reachable, covered,
+      ok ? "ok" : "FAILED", std::chrono::duration<double, std::milli>(end - begin).count());
+    return ok ? 0 : 1;
+  }
 
-        if (segments.empty()) return colliders;
+  // Tiles a width x height map with both solvers and prints their time,
+  // piece count and coverage. Every tiling must have its rooms connected.
+  int solve(int width, int height, uint64_t seed) {
+    int failures = 0;
+    for (auto [name, solver] : {std::pair{"scan", pavage::solver_kind::scan}, std::pair{"frontier", pavage::solver_kind::frontier}}) {
+      auto begin = std::chrono::steady_clock::now();
+      pavage::map_t m(width, height, 10, pavage::pieces, seed, false, {}, solver);
+      auto end = std::chrono::steady_clock::now();
+
+      const std::vector<int> rooms = m.room_map();
+      const auto covered = std::count_if(rooms.begin(), rooms.end(), [](int room) { return room >= 0; });
+      const bool connected = m.room_graph().is_connected();
+      failures += !connected;
+      std::printf("%-9s %4d pieces, %6td of %zu cells covered, %s, %.1f ms\n", name, m.room_graph().room_count(), covered,
+        rooms.size(), connected ? "connected" : "NOT CONNECTED", std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+    return failures == 0 ? 0 : 1;
+  }
 
-        for (const auto& seg : segments) {
-          double length = cell_size;
-          vector_t centroid;
+  // Placement tests per second, cell by cell and with the row masks, on the
+  // tiling of a width x height map: random positions and variants of every
+  // piece, the two must agree on each of them. Then solves the map both ways,
+  // the tilings must be the same.
+  int place(int width, int height, uint64_t seed) {
+    constexpr int tests = 2'000'000;
+    pavage::map_t m(width, height, 10, pavage::pieces, seed);
+    rng_t rng(seed);
+    std::vector<std::array<int, 4>> queries(tests);
+    for (auto& [p, v, x, y] : queries) {
+      p = rng.uniform(0, static_cast<int>(pavage::pieces.size()) - 1);
+      v = rng.uniform(0, m.placer.variant_count(p) - 1);
+      x = rng.uniform(0, width - 1);
+      y = rng.uniform(0, height - 1);
+    }
 
-          if (seg.is_horizontal) {
-            centroid = { (seg.x + 0.5) * cell_size, seg.y * cell_size, 0.0 };
-          } else {
-            centroid = { seg.x * cell_size, (seg.y + 0.5) * cell_size, 0.0 };
-          }
+    std::vector<uint8_t> results[2];
+    double seconds[2];
+    for (int mode = 0; mode < 2; ++mode) {
+      m.placer.use_bitboard(mode == 1);
+      results[mode].reserve(tests);
+      auto begin = std::chrono::steady_clock::now();
+      for (const auto& [p, v, x, y] : queries) results[mode].push_back(m.placer.fits(p, v, x, y));
+      auto end = std::chrono::steady_clock::now();
+      seconds[mode] = std::chrono::duration<double>(end - begin).count();
+    }
+    const auto fitting = std::count(results[1].begin(), results[1].end(), 1);
+    int failures = results[0] != results[1];
+    std::printf("%d tests, %td fit: cells %.1f M/s, masks %.1f M/s (x%.1f)\n", tests, fitting,
+      tests / seconds[0] / 1e6, tests / seconds[1] / 1e6, seconds[0] / seconds[1]);
+
+    for (auto solver : {pavage::solver_kind::scan, pavage::solver_kind::frontier}) {
+      std::vector<int> tilings[2];
+      for (int mode = 0; mode < 2; ++mode) {
+        pavage::placement_t placer(width, height, pavage::pieces, seed);
+        placer.use_bitboard(mode == 1);
+        auto begin = std::chrono::steady_clock::now();
+        placer.solve(solver);
+        auto end = std::chrono::steady_clock::now();
+        seconds[mode] = std::chrono::duration<double, std::milli>(end - begin).count();
+        tilings[mode] = placer.room_map();
+      }
+      failures += tilings[0] != tilings[1];
+      std::printf("%-8s solve: cells %.1f ms, masks %.1f ms, %s\n", solver == pavage::solver_kind::scan ? "scan" : "frontier",
+        seconds[0], seconds[1], tilings[0] == tilings[1] ? "same tiling" : "DIFFERENT TILINGS");
+    }
+    return failures == 0 ? 0 : 1;
+  }
 
-          colliders.emplace_back(std::make_shared<collider_t>(
-            centroid, 
-            seg.is_horizontal ? wall_orientation::H : wall_orientation::V, length, 
-            seg.is_door));
+  // Variants the catalog had before it was expanded at compile time, rebuilt
+  // at run time with vectors as the reference.
+  std::vector<pavage::shape_t> reference_variants(const pavage::piece_t& piece) {
+    std::vector<pavage::shape_t> variants;
+    pavage::shape_t current(piece.cells.begin(), piece.cells.end());
+    for (int flip = 0; flip < 2; ++flip) {
+      for (int rot = 0; rot < 4; ++rot) {
+        int minx = INT_MAX, miny = INT_MAX;
+        for (auto [x, y] : current) {
+          minx = std::min(minx, x);
+          miny = std::min(miny, y);
         }
-
-        return colliders;
+        pavage::shape_t normalized;
+        for (auto [x, y] : current) normalized.push_back({x - minx, y - miny});
+        std::sort(normalized.begin(), normalized.end());
+        if (std::find(variants.begin(), variants.end(), normalized) == variants.end()) variants.push_back(normalized);
+        for (auto& [x, y] : current) std::tie(x, y) = std::make_pair(-y, x);
       }
-    };
+      for (auto& [x, y] : current) x = -x;
+    }
+    return variants;
+  }
 
-  public:
-    placement_t(int w, int h, std::vector<piece_t> p) 
-      : width(w), height(h), pieces(p), grid(h, std::vector<int>(w, -1)) {}
+  // Compares the variants and row masks of the catalog with the reference,
+  // in the same order, then checks that make_piece rejects what can't be a
+  // piece.
+  int check_catalog() {
+    int failures = 0;
+    int variants = 0;
+    for (const pavage::piece_t& piece : pavage::catalog) {
+      const auto expected = reference_variants(piece);
+      failures += piece.variants.size() != static_cast<int>(expected.size());
+      for (int v = 0; v < std::min(piece.variants.size(), static_cast<int>(expected.size())); ++v) {
+        const pavage::variant_t& variant = piece.variants[v];
+        failures += !std::equal(variant.begin(), variant.end(), expected[v].begin(), expected[v].end());
+        for (auto [x, y] : expected[v]) failures += !(variant.rows[y] >> x & 1);
+        int bits = 0;
+        for (uint64_t row : variant.rows) bits += std::popcount(row);
+        failures += bits != static_cast<int>(expected[v].size());
+      }
+      variants += piece.variants.size();
+    }
 
-    vector_t retrieve_safe_point(int segment_length) {
-      std::uniform_int_distribution<int> dist_x(0, width - 1);
-      std::uniform_int_distribution<int> dist_y(0, height - 1);
+    std::vector<std::pair<int, int>> wide;
+    for (int x = 0; x <= pavage::piece_shape_t::max_extent; ++x) wide.push_back({x, 0});
+    const std::vector<std::pair<int, int>> repeated = {{0, 0}, {1, 0}, {0, 0}};
+    const std::vector<std::pair<int, int>> tee = {{0, 0}, {1, 0}, {2, 0}, {1, 1}};
+    failures += pavage::make_piece({}, 1, 1).has_value();
+    failures += pavage::make_piece(wide, 1, 1).has_value();
+    failures += pavage::make_piece(repeated, 1, 1).has_value();
+    auto piece = pavage::make_piece(tee, 1, 1);
+    failures += !piece || piece->variants.size() != 4;
+
+    std::printf("%zu pieces, %d variants, %d failures\n", pavage::catalog.size(), variants, failures);
+    return failures == 0 ? 0 : 1;
+  }
 
-      int rx, ry;
+  // Portfolio of `solves` frontier solves of a width x height map on
+  // `threads` workers within budget_ms (0 for no limit). Without a budget the
+  // winner must not depend on the number of threads.
+  int portfolio(int width, int height, uint64_t seed, int solves, int threads, int budget_ms) {
+    pavage::portfolio_config_t config;
+    config.solves = solves;
+    config.threads = threads;
+    config.budget = std::chrono::milliseconds(budget_ms);
+
+    auto begin = std::chrono::steady_clock::now();
+    pavage::portfolio_result_t result = pavage::solve_portfolio(width, height, pavage::pieces, seed, config);
+    auto end = std::chrono::steady_clock::now();
+
+    pavage::placement_t single(width, height, pavage::pieces, seed);
+    single.solve(pavage::solver_kind::frontier);
+
+    std::printf("solve %d of %d wins with %.0f of %d cells (single solve %d), %d completed, %.1f ms\n", result.solve,
+      solves, result.score, width * height, single.covered_cells(), result.completed,
+      std::chrono::duration<double, std::milli>(end - begin).count());
+
+    if (budget_ms > 0) return 0;
+    config.threads = 1;
+    pavage::portfolio_result_t sequential = pavage::solve_portfolio(width, height, pavage::pieces, seed, config);
+    const bool same = sequential.solve == result.solve && sequential.placement.room_map() == result.placement.room_map();
+    std::printf("%s tiling on one thread\n", same ? "same" : "DIFFERENT");
+    return same ? 0 : 1;
+  }
+}
 
-      do {
-        rx = dist_x(rng);
-        ry = dist_y(rng);
-      } while (grid[ry][rx] == -1);
+int main(int argc, char** argv) {
+  using namespace pavage; 
 
-      std::uniform_int_distribution<int> offset(
-      -segment_length * 0.75 / 2, segment_length * 0.75 / 2);
+  if (argc > 1 && std::strcmp(argv[1], "hash") == 0) {
+    return golden(nullptr);
+  }
 
-      return vector_t{
-        rx * segment_length + segment_length / 2.0 + offset(rng),
-        ry * segment_length + segment_length / 2.0 + offset(rng),
-        0.0
-      };
-    }
+  if (argc > 2 && std::strcmp(argv[1], "check") == 0) {
+    return golden(argv[2]);
+  }
 
-    void solve() {
-      bool placed = true;
-      while (placed) {
-        placed = false;
-
-        std::vector<int> order(pieces.size());
-        for (int i = 0; i < pieces.size(); ++i) { order[i] = i; }
-        std::shuffle(order.begin(), order.end(), rng);
-        
-        for (int p_idx : order) {
-          if (pieces[p_idx].used_count >= pieces[p_idx].max_count) { continue; }
-
-          shape_t positions;
-          for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-              positions.push_back({x, y});
-            }
-          }
-          std::shuffle(positions.begin(), positions.end(), rng);
-
-          auto variants = pieces[p_idx].get_variants();
-          std::shuffle(variants.begin(), variants.end(), rng);
-
-          for (auto [x, y] : positions) {
-            if (placed) break;
-            for (const auto& variant : variants) {
-              if (can_place(variant, x, y) && touches_existing(variant, x, y)) {
-                place(p_idx, variant, x, y);
-                placed = true;
-                break;
-              }
-            }
-          }
-          if (placed) break;
-        }
-      }
-    }
+  if (argc > 3 && std::strcmp(argv[1], "floor") == 0) {
+    uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 42;
+    return floor(std::atoi(argv[2]), std::atoi(argv[3]), seed);
+  }
 
-    std::vector<std::shared_ptr<collider_t>> retrieve_walls(double cell_size) {
-      collider_gen_t collider_gen{width, height, cell_size};
-      auto segments = collider_gen.extract_wall_segments(grid);
-      return collider_gen.generate_colliders(segments);
-    }
+  if (argc > 1 && std::strcmp(argv[1], "catalog") == 0) {
+    return check_catalog();
+  }
 
-    void display() {
-      for (auto& row : grid) {
-        for (int cell : row) {
-          if (cell == -1) {
-            std::cout << ". ";
-          } else {
-            std::cout << (char)('A' + cell % 26) << ' ';
-          }
-        }
-        std::cout << "\n";
-      }
-    }
-  };
+  if (argc > 3 && std::strcmp(argv[1], "portfolio") == 0) {
+    uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 42;
+    return portfolio(std::atoi(argv[2]), std::atoi(argv[3]), seed, argc > 5 ? std::atoi(argv[5]) : 16,
+      argc > 6 ? std::atoi(argv[6]) : 0, argc > 7 ? std::atoi(argv[7]) : 0);
+  }
 
-  struct map_t {
-    int width, height, cell_size;
-    std::vector<std::shared_ptr<collider_t>> walls;
-    placement_t placer;
+  if (argc > 3 && std::strcmp(argv[1], "place") == 0) {
+    uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 42;
+    return place(std::atoi(argv[2]), std::atoi(argv[3]), seed);
+  }
 
-    map_t(int w, int h, int segment_length, std::vector<piece_t> pieces)
-      : width(w), height(h), cell_size(segment_length), placer(w, h, pieces) {
-      placer.solve();
-      walls = placer.retrieve_walls(cell_size);
-    }
+  if (argc > 3 && std::strcmp(argv[1], "solve") == 0) {
+    uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 42;
+    return solve(std::atoi(argv[2]), std::atoi(argv[3]), seed);
+  }
 
-    vector_t retrieve_safe_point() { return placer.retrieve_safe_point(cell_size); }
-    std::vector<std::shared_ptr<collider_t>>& get_walls() { return walls; }
-
-    [[nodiscard]] std::string latex() const {
-      std::ostringstream oss;
-      oss << std::fixed << std::setprecision(2);
-
-      oss << "\\documentclass[margin=5pt]{standalone}\n"
-          << "\\usepackage{tikz}\n"
-          << "\\begin{document}\n"
-          << "\\begin{tikzpicture}[scale=0.5]\n";
-      for (const auto& wall : walls) {
-        const auto& c = wall->centroid;
-        double half = wall->length / 2.0;
-
-        std::string color = wall->is_door ? "red" : "black";
-
-        if (wall->orientation == wall_orientation::H) {
-          oss << "\\draw[" << color << "] (" << c.X - half << "," << c.Y << ") -- ("
-              << c.X + half << "," << c.Y << ");\n";
-        } else {
-          oss << "\\draw[" << color << "] (" << c.X << "," << c.Y - half << ") -- ("
-              << c.X << "," << c.Y + half << ");\n";
-        }
-      }
-      oss << "\\end{tikzpicture}\n"
-          << "\\end{document}\n";
+  if (argc > 3 && std::strcmp(argv[1], "rooms") == 0) {
+    uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 42;
+    return rooms(std::atoi(argv[2]), std::atoi(argv[3]), seed, argc > 5 ? std::atof(argv[5]) : 0.1);
+  }
 
-      return oss.str();
-    }
-  };
-};
+  if (argc > 1 && std::strcmp(argv[1], "segments") == 0) {
+    uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 42;
+    return segments(argc > 2 ? std::atoi(argv[2]) : 1000, seed);
+  }
 
-int main() {
-  using namespace pavage; 
+  uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : std::random_device{}();
+  std::cerr << "seed " << seed << "\n";
 
   std::vector<piece_t> pieces = {
     // { 
@@ -432,7 +433,7 @@ int main() {
     }
   };
 
-  map_t map(20, 20, 10, pieces);
+  map_t map(20, 20, 10, pieces, seed);
   std::cout << map.latex();
 
   return 0;